@@ -0,0 +1,597 @@
+// Benchmarks for the DiffBotSystemHardware hot paths, run against the
+// simulated GPIO backends so they work on any machine.
+//
+// Besides the time per iteration every benchmark reports:
+//   allocs_per_iter  heap allocations per iteration (global operator new)
+//   p50_ns/p99_ns/p999_ns/max_ns  per-call latency percentiles, where the
+//                    benchmark times individual calls
+//
+// Results are written as JSON to diffbot_benchmark.json unless
+// --benchmark_out is given on the command line.
+//
+// When pigpiod_if2 is available, the BM_Pigpiod* benchmarks run the real
+// client path against FakePigpiod on localhost, with injected latency,
+// jitter and connection loss.
+
+#include <benchmark/benchmark.h>
+
+#include <signal.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "diffdrive_mini_ocebot/controller.hpp"
+#include "diffdrive_mini_ocebot/diffbot_system.hpp"
+#include "diffdrive_mini_ocebot/sim_backend.hpp"
+#include "diffdrive_mini_ocebot/wheel.hpp"
+#include "hardware_interface/types/hardware_interface_type_values.hpp"
+
+#include "fake_pigpiod.hpp"
+
+namespace
+{
+std::atomic<uint64_t> allocations{0};
+}  // namespace
+
+// GCC sees the malloc/free pair through the replaced operators and warns
+// about a mismatch that does not exist.
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+
+void * operator new(std::size_t size)
+{
+  allocations.fetch_add(1, std::memory_order_relaxed);
+  if (void * ptr = std::malloc(size == 0 ? 1 : size))
+  {
+    return ptr;
+  }
+  throw std::bad_alloc();
+}
+
+void operator delete(void * ptr) noexcept
+{
+  std::free(ptr);
+}
+
+void operator delete(void * ptr, std::size_t) noexcept
+{
+  std::free(ptr);
+}
+
+namespace
+{
+using diffdrive_mini_ocebot::DiffBotSystemHardware;
+using Overrides = std::unordered_map<std::string, std::string>;
+
+const rclcpp_lifecycle::State kState;
+const rclcpp::Duration kPeriod(0, 100000000);
+
+hardware_interface::HardwareInfo make_info(const Overrides & overrides)
+{
+  hardware_interface::HardwareInfo info;
+  info.name = "diffdrive";
+  info.hardware_parameters = {
+    {"left_wheel_name", "left_wheel_joint"},
+    {"right_wheel_name", "right_wheel_joint"},
+    {"left_wheel_pin", "18"},
+    {"right_wheel_pin", "22"},
+    {"left_direction_pin", "23"},
+    {"right_direction_pin", "24"},
+    {"left_encoder_pin", "3"},
+    {"right_encoder_pin", "4"},
+    {"enc_counts_per_rev", "3640"},
+    {"gpio_backend", "sim"},
+  };
+  for (const auto & parameter : overrides)
+  {
+    info.hardware_parameters[parameter.first] = parameter.second;
+  }
+
+  for (const char * name : {"left_wheel_joint", "right_wheel_joint"})
+  {
+    hardware_interface::ComponentInfo joint;
+    joint.name = name;
+    joint.type = "joint";
+    hardware_interface::InterfaceInfo velocity;
+    velocity.name = hardware_interface::HW_IF_VELOCITY;
+    hardware_interface::InterfaceInfo position;
+    position.name = hardware_interface::HW_IF_POSITION;
+    joint.command_interfaces = {velocity};
+    joint.state_interfaces = {position, velocity};
+    info.joints.push_back(joint);
+  }
+  return info;
+}
+
+// count wheel joints with their pins as joint parameters, alternating
+// left and right, on the simulated plant with quadrature encoders.
+hardware_interface::HardwareInfo make_wheel_info(size_t count)
+{
+  hardware_interface::HardwareInfo info;
+  info.name = "diffdrive";
+  info.hardware_parameters = {
+    {"enc_counts_per_rev", "3640"},
+    {"gpio_backend", "sim_motor"},
+    {"wheel_separation", "0.10"},
+    {"wheel_radius", "0.015"},
+  };
+
+  for (size_t i = 0; i < count; i++)
+  {
+    const int base = 2 + 6 * static_cast<int>(i);
+    hardware_interface::ComponentInfo joint;
+    joint.name = "wheel_" + std::to_string(i) + "_joint";
+    joint.type = "joint";
+    joint.parameters = {
+      {"pwm_pin", std::to_string(base)},
+      {"direction_pin", std::to_string(base + 1)},
+      {"encoder_pin", std::to_string(base + 2)},
+      {"encoder_b_pin", std::to_string(base + 3)},
+      {"side", i % 2 == 0 ? "left" : "right"},
+    };
+    hardware_interface::InterfaceInfo velocity;
+    velocity.name = hardware_interface::HW_IF_VELOCITY;
+    hardware_interface::InterfaceInfo position;
+    position.name = hardware_interface::HW_IF_POSITION;
+    joint.command_interfaces = {velocity};
+    joint.state_interfaces = {position, velocity};
+    info.joints.push_back(joint);
+  }
+  return info;
+}
+
+// Hardware brought up to the active state, with the exported interfaces.
+// error names the lifecycle step that failed, empty when it came up.
+struct ActiveHardware
+{
+  DiffBotSystemHardware hardware;
+  std::vector<hardware_interface::StateInterface> states;
+  std::vector<hardware_interface::CommandInterface> commands;
+  std::string error;
+
+  explicit ActiveHardware(const Overrides & overrides)
+  : ActiveHardware(make_info(overrides))
+  {
+  }
+
+  explicit ActiveHardware(const hardware_interface::HardwareInfo & info)
+  {
+    if (hardware.on_init(info) != hardware_interface::CallbackReturn::SUCCESS)
+    {
+      error = "on_init failed";
+      return;
+    }
+    states = hardware.export_state_interfaces();
+    commands = hardware.export_command_interfaces();
+    if (hardware.on_configure(kState) != hardware_interface::CallbackReturn::SUCCESS)
+    {
+      error = "on_configure failed";
+      return;
+    }
+    configured_ = true;
+    if (hardware.on_activate(kState) != hardware_interface::CallbackReturn::SUCCESS)
+    {
+      error = "on_activate failed";
+      return;
+    }
+    active_ = true;
+  }
+
+  ~ActiveHardware()
+  {
+    if (active_)
+    {
+      hardware.on_deactivate(kState);
+    }
+    if (configured_)
+    {
+      hardware.on_cleanup(kState);
+    }
+  }
+
+  void set_command(double left, double right)
+  {
+    commands[0].set_value(left);
+    commands[1].set_value(right);
+  }
+
+private:
+  bool configured_ = false;
+  bool active_ = false;
+};
+
+// Skips the benchmark when its setup failed, rather than timing a dead
+// hardware object.
+bool setup_succeeded(benchmark::State & state, const std::string & error)
+{
+  if (error.empty())
+  {
+    return true;
+  }
+  state.SkipWithError(error.c_str());
+  return false;
+}
+
+// Per-call latency samples, reported as percentile counters.
+class LatencyRecorder
+{
+public:
+  explicit LatencyRecorder(size_t capacity) {samples_.reserve(capacity);}
+
+  template<typename Function>
+  void time(Function && function)
+  {
+    auto start = std::chrono::steady_clock::now();
+    function();
+    auto end = std::chrono::steady_clock::now();
+    if (samples_.size() < samples_.capacity())
+    {
+      samples_.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count());
+    }
+  }
+
+  void report(benchmark::State & state)
+  {
+    if (samples_.empty())
+    {
+      return;
+    }
+    std::sort(samples_.begin(), samples_.end());
+    auto percentile = [this](double p) {
+        return static_cast<double>(samples_[static_cast<size_t>(p * (samples_.size() - 1))]);
+      };
+    state.counters["p50_ns"] = percentile(0.5);
+    state.counters["p99_ns"] = percentile(0.99);
+    state.counters["p999_ns"] = percentile(0.999);
+    state.counters["max_ns"] = static_cast<double>(samples_.back());
+  }
+
+private:
+  std::vector<int64_t> samples_;
+};
+
+void report_allocations(benchmark::State & state, uint64_t before)
+{
+  state.counters["allocs_per_iter"] = benchmark::Counter(
+    static_cast<double>(allocations.load() - before), benchmark::Counter::kAvgIterations);
+}
+
+// read() while the simulated plant produces encoder edges in real time.
+// Arg 0: position-difference velocity, 1: M/T edge velocity.
+void BM_Read(benchmark::State & state)
+{
+  ActiveHardware hw(Overrides{
+      {"gpio_backend", "sim_motor"},
+      {"left_encoder_b_pin", "17"},
+      {"right_encoder_b_pin", "27"},
+      {"velocity_estimation", state.range(0) ? "mt" : "difference"}});
+  if (!setup_succeeded(state, hw.error))
+  {
+    return;
+  }
+  hw.set_command(8.0, -8.0);
+  hw.hardware.write(rclcpp::Time(), kPeriod);
+
+  LatencyRecorder latency(1 << 20);
+  uint64_t before = allocations.load();
+  for (auto _ : state)
+  {
+    latency.time([&hw]() {hw.hardware.read(rclcpp::Time(), kPeriod);});
+  }
+  report_allocations(state, before);
+  latency.report(state);
+}
+BENCHMARK(BM_Read)->Arg(0)->Arg(1);
+
+// write() in open loop. Arg 0: repeated command (shadow registers elide the
+// GPIO calls), 1: command changes every cycle, 2: changing command through
+// the asynchronous I/O thread.
+void BM_Write(benchmark::State & state)
+{
+  ActiveHardware hw(Overrides{{"async_io", state.range(0) == 2 ? "true" : "false"}});
+  if (!setup_succeeded(state, hw.error))
+  {
+    return;
+  }
+
+  LatencyRecorder latency(1 << 20);
+  uint64_t before = allocations.load();
+  double command = 1.0;
+  for (auto _ : state)
+  {
+    if (state.range(0) != 0)
+    {
+      command = command > 10.0 ? 1.0 : command + 1.0;
+    }
+    hw.set_command(command, -command);
+    latency.time([&hw]() {hw.hardware.write(rclcpp::Time(), kPeriod);});
+  }
+  report_allocations(state, before);
+  latency.report(state);
+}
+BENCHMARK(BM_Write)->Arg(0)->Arg(1)->Arg(2);
+
+// write() with the velocity PID.
+void BM_WritePid(benchmark::State & state)
+{
+  ActiveHardware hw(Overrides{{"control_mode", "pid"}, {"pid_kp", "2"}, {"pid_ki", "20"}});
+  if (!setup_succeeded(state, hw.error))
+  {
+    return;
+  }
+  hw.set_command(5.0, 5.0);
+
+  LatencyRecorder latency(1 << 20);
+  uint64_t before = allocations.load();
+  for (auto _ : state)
+  {
+    latency.time([&hw]() {hw.hardware.write(rclcpp::Time(), kPeriod);});
+  }
+  report_allocations(state, before);
+  latency.report(state);
+}
+BENCHMARK(BM_WritePid);
+
+// read() plus write() with the given number of wheels, PID and odometry on,
+// to check that the cost per wheel stays flat.
+void BM_ReadWriteWheels(benchmark::State & state)
+{
+  const size_t count = static_cast<size_t>(state.range(0));
+  hardware_interface::HardwareInfo info = make_wheel_info(count);
+  info.hardware_parameters["control_mode"] = "pid";
+  info.hardware_parameters["pid_kp"] = "2";
+  info.hardware_parameters["pid_ki"] = "20";
+  ActiveHardware hw(info);
+  if (!setup_succeeded(state, hw.error))
+  {
+    return;
+  }
+  for (size_t i = 0; i < count; i++)
+  {
+    hw.commands[i].set_value(i % 2 == 0 ? 6.0 : 8.0);
+  }
+
+  LatencyRecorder latency(1 << 20);
+  uint64_t before = allocations.load();
+  for (auto _ : state)
+  {
+    latency.time([&hw]() {
+        hw.hardware.read(rclcpp::Time(), kPeriod);
+        hw.hardware.write(rclcpp::Time(), kPeriod);
+      });
+  }
+  state.SetItemsProcessed(state.iterations() * count);
+  report_allocations(state, before);
+  latency.report(state);
+}
+BENCHMARK(BM_ReadWriteWheels)->Arg(2)->Arg(4)->Arg(6)->Arg(8);
+
+// Parameter parsing and validation in on_init.
+void BM_OnInit(benchmark::State & state)
+{
+  const hardware_interface::HardwareInfo info = make_info({});
+  {
+    DiffBotSystemHardware hardware;
+    if (!setup_succeeded(
+        state, hardware.on_init(info) == hardware_interface::CallbackReturn::SUCCESS ? "" : "on_init failed"))
+    {
+      return;
+    }
+  }
+  uint64_t before = allocations.load();
+  for (auto _ : state)
+  {
+    DiffBotSystemHardware hardware;
+    benchmark::DoNotOptimize(hardware.on_init(info));
+  }
+  report_allocations(state, before);
+}
+BENCHMARK(BM_OnInit);
+
+// Encoder edge callback throughput through the Controller decoding path.
+// Arg 0: single channel, 1: quadrature.
+void BM_EncoderCallback(benchmark::State & state)
+{
+  const bool quadrature = state.range(0) != 0;
+  auto backend = std::make_unique<SimBackend>();
+  SimBackend * sim = backend.get();
+  Controller controller;
+  WheelArray wheels({"left", "right"}, {3640, 3640});
+  if (
+    !controller.setup(
+      std::move(backend), {MotorPins{18, 23, 1, 3, quadrature ? 17 : -1}, MotorPins{22, 24, 0, 4, -1}}) ||
+    !controller.register_encoders(wheels.counts.get(), wheels.edges.get()))
+  {
+    state.SkipWithError("Controller setup failed");
+    return;
+  }
+
+  // Forward quadrature sequence on A = 3, B = 17.
+  const unsigned pins[4] = {17, 3, 17, 3};
+  const unsigned levels[4] = {1, 1, 0, 0};
+
+  uint64_t before = allocations.load();
+  uint32_t tick = 0;
+  for (auto _ : state)
+  {
+    for (unsigned i = 0; i < 1024; i++)
+    {
+      unsigned phase = i & 3;
+      sim->inject_edge(quadrature ? pins[phase] : 3, levels[phase], tick++);
+    }
+    wheels.edges[0].clear();
+  }
+  state.SetItemsProcessed(state.iterations() * 1024);
+  report_allocations(state, before);
+  state.counters["errors"] = controller.encoder_errors();
+}
+BENCHMARK(BM_EncoderCallback)->Arg(0)->Arg(1);
+
+#ifdef DIFFDRIVE_MINI_OCEBOT_WITH_PIGPIOD
+// Hardware on the pigpiod backend, connected to a FakePigpiod. error is
+// empty when both came up.
+struct PigpiodHardware
+{
+  FakePigpiod daemon;
+  std::unique_ptr<ActiveHardware> hw;
+  std::string error;
+
+  explicit PigpiodHardware(Overrides overrides)
+  {
+    if (!daemon.start())
+    {
+      error = "FakePigpiod could not listen on 127.0.0.1";
+      return;
+    }
+    overrides["gpio_backend"] = "pigpiod";
+    overrides["gpio_device"] = "127.0.0.1:" + std::to_string(daemon.port());
+    hw = std::make_unique<ActiveHardware>(overrides);
+    error = hw->error;
+  }
+};
+
+// write() with a command change every cycle, so every motor pin is sent.
+// Args: daemon latency and jitter in us, async_io (0/1).
+void BM_PigpiodWrite(benchmark::State & state)
+{
+  PigpiodHardware pigpiod(Overrides{{"async_io", state.range(2) ? "true" : "false"}});
+  if (!setup_succeeded(state, pigpiod.error))
+  {
+    return;
+  }
+  pigpiod.daemon.set_latency(
+    std::chrono::microseconds(state.range(0)), std::chrono::microseconds(state.range(1)));
+  ActiveHardware & hw = *pigpiod.hw;
+
+  LatencyRecorder latency(1 << 20);
+  double command = 1.0;
+  for (auto _ : state)
+  {
+    command = command > 10.0 ? 1.0 : command + 1.0;
+    hw.set_command(command, -command);
+    latency.time([&hw]() {hw.hardware.write(rclcpp::Time(), kPeriod);});
+  }
+  latency.report(state);
+  state.counters["daemon_commands"] = static_cast<double>(pigpiod.daemon.commands());
+}
+BENCHMARK(BM_PigpiodWrite)
+  ->Args({0, 0, 0})->Args({100, 0, 0})->Args({100, 100, 0})->Args({1000, 500, 0})->Args({1000, 500, 1})
+  ->UseRealTime();
+
+// Encoder edges from the daemon through the notification socket and the
+// pigpiod_if2 callback thread until read() has counted them. Arg: daemon
+// latency in us, which must not slow the edge stream.
+void BM_PigpiodEncoder(benchmark::State & state)
+{
+  PigpiodHardware pigpiod(Overrides{{"velocity_estimation", "difference"}});
+  if (!setup_succeeded(state, pigpiod.error))
+  {
+    return;
+  }
+  pigpiod.daemon.set_latency(std::chrono::microseconds(state.range(0)), std::chrono::microseconds(0));
+  ActiveHardware & hw = *pigpiod.hw;
+  const double rads_per_count = 2 * M_PI / 3640;
+
+  unsigned level = 0;
+  double expected = 0;
+  for (auto _ : state)
+  {
+    for (unsigned i = 0; i < 256; i++)
+    {
+      level ^= 1;
+      pigpiod.daemon.inject_edge(3, level);
+    }
+    expected += 256 * rads_per_count;
+
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(1);
+    do
+    {
+      hw.hardware.read(rclcpp::Time(), kPeriod);
+    } while (hw.states[0].get_value() < expected - rads_per_count / 2 &&
+      std::chrono::steady_clock::now() < deadline);
+  }
+  state.SetItemsProcessed(state.iterations() * 256);
+  state.counters["lost_edges"] = std::round((expected - hw.states[0].get_value()) / rads_per_count);
+}
+BENCHMARK(BM_PigpiodEncoder)->Arg(0)->Arg(1000)->UseRealTime();
+
+// write() after the daemon dropped the connection, as on a pigpiod
+// restart: the backend does not reconnect, so this measures how fast the
+// failing calls return. A send on the dropped socket may raise SIGPIPE,
+// which is ignored here.
+void BM_PigpiodDaemonLoss(benchmark::State & state)
+{
+  struct sigaction ignore{};
+  struct sigaction previous{};
+  ignore.sa_handler = SIG_IGN;
+  sigaction(SIGPIPE, &ignore, &previous);
+
+  {
+    PigpiodHardware pigpiod(Overrides{});
+    if (!setup_succeeded(state, pigpiod.error))
+    {
+      sigaction(SIGPIPE, &previous, nullptr);
+      return;
+    }
+    ActiveHardware & hw = *pigpiod.hw;
+    hw.hardware.write(rclcpp::Time(), kPeriod);
+    pigpiod.daemon.disconnect_clients();
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+    LatencyRecorder latency(1 << 20);
+    double command = 1.0;
+    for (auto _ : state)
+    {
+      command = command > 10.0 ? 1.0 : command + 1.0;
+      hw.set_command(command, -command);
+      latency.time([&hw]() {hw.hardware.write(rclcpp::Time(), kPeriod);});
+    }
+    latency.report(state);
+    state.counters["daemon_commands"] = static_cast<double>(pigpiod.daemon.commands());
+  }
+
+  sigaction(SIGPIPE, &previous, nullptr);
+}
+BENCHMARK(BM_PigpiodDaemonLoss)->UseRealTime();
+#endif
+
+}  // namespace
+
+int main(int argc, char ** argv)
+{
+  std::vector<char *> args(argv, argv + argc);
+  bool has_out = false;
+  for (int i = 1; i < argc; i++)
+  {
+    has_out = has_out || std::strncmp(argv[i], "--benchmark_out=", 16) == 0;
+  }
+
+  char out[] = "--benchmark_out=diffbot_benchmark.json";
+  char format[] = "--benchmark_out_format=json";
+  if (!has_out)
+  {
+    args.push_back(out);
+    args.push_back(format);
+  }
+
+  int count = static_cast<int>(args.size());
+  benchmark::Initialize(&count, args.data());
+  if (benchmark::ReportUnrecognizedArguments(count, args.data()))
+  {
+    return 1;
+  }
+  benchmark::RunSpecifiedBenchmarks();
+  benchmark::Shutdown();
+  return 0;
+}
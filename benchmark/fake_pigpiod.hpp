@@ -0,0 +1,511 @@
+// Stand-in for pigpiod on localhost, for running the real pigpiod_if2 client
+// path (PigpiodBackend / PigpiodSession) without a Raspberry Pi.
+//
+// Speaks the pigpiod socket protocol for the commands the Controller uses:
+// MODES/MODEG, READ, WRITE, PWM, GDC, PRS/PRG, PFS/PFG, HP, BR1, TICK and
+// in-band notifications (NOIB, NB, NP, NC), which carry callback_ex edges.
+// Pipe notifications (NO, the pigpiod_notify backend) are not served.
+// Other commands answer -1.
+//
+// Faults can be injected while clients are connected: a fixed latency and
+// a uniformly distributed jitter before every reply, and dropping every
+// connection (on request or after a number of commands), as a daemon
+// restart would.
+
+#ifndef DIFFDRIVE_MINI_OCEBOT__FAKE_PIGPIOD_HPP_
+#define DIFFDRIVE_MINI_OCEBOT__FAKE_PIGPIOD_HPP_
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <thread>
+
+#if __has_include(<pigpio.h>)
+#include <pigpio.h>
+#endif
+
+class FakePigpiod
+{
+public:
+  static constexpr unsigned MAX_GPIO = 54;
+  static constexpr unsigned MAX_NOTIFY = 32;
+
+  // Command numbers and errors of pigpio.h, kept here so the daemon also
+  // builds where pigpio is not installed.
+  enum Command : uint32_t
+  {
+    MODES = 0,
+    MODEG = 1,
+    READ = 3,
+    WRITE = 4,
+    PWM = 5,
+    PRS = 6,
+    PFS = 7,
+    BR1 = 10,
+    TICK = 16,
+    NB = 19,
+    NP = 20,
+    NC = 21,
+    PRG = 22,
+    PFG = 23,
+    GDC = 83,
+    HP = 86,
+    NOIB = 99,
+  };
+  static constexpr int BAD_COMMAND = -1;
+  static constexpr int BAD_HANDLE = -25;
+  static constexpr int NO_HANDLE = -24;
+
+  FakePigpiod() = default;
+  FakePigpiod(const FakePigpiod &) = delete;
+  FakePigpiod & operator=(const FakePigpiod &) = delete;
+
+  ~FakePigpiod() {stop();}
+
+  // Listens on 127.0.0.1:port, 0 for any free port. Clients connect with
+  // pigpio_start("127.0.0.1", port()) or gpio_device "127.0.0.1:<port>".
+  bool start(uint16_t port = 0)
+  {
+    listen_fd_ = socket(AF_INET, SOCK_STREAM, 0);
+    if (listen_fd_ < 0)
+    {
+      return false;
+    }
+    int reuse = 1;
+    setsockopt(listen_fd_, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = htons(port);
+    socklen_t length = sizeof(address);
+    if (
+      bind(listen_fd_, reinterpret_cast<sockaddr *>(&address), sizeof(address)) < 0 ||
+      listen(listen_fd_, 8) < 0 ||
+      getsockname(listen_fd_, reinterpret_cast<sockaddr *>(&address), &length) < 0)
+    {
+      close(listen_fd_);
+      listen_fd_ = -1;
+      return false;
+    }
+    port_ = ntohs(address.sin_port);
+    start_time_ = std::chrono::steady_clock::now();
+    running_ = true;
+    acceptor_ = std::thread(&FakePigpiod::accept_loop, this);
+    return true;
+  }
+
+  void stop()
+  {
+    if (!running_.exchange(false))
+    {
+      return;
+    }
+    shutdown(listen_fd_, SHUT_RDWR);
+    acceptor_.join();
+    close(listen_fd_);
+    listen_fd_ = -1;
+
+    // Joined outside the lock: a client thread may be disconnecting.
+    std::list<std::unique_ptr<Client>> clients;
+    {
+      std::lock_guard<std::mutex> lock(clients_mutex_);
+      drop_connections();
+      clients.swap(clients_);
+    }
+    for (auto & client : clients)
+    {
+      client->thread.join();
+    }
+  }
+
+  uint16_t port() const {return port_;}
+
+  // Delay before every reply: latency plus a uniform 0..jitter.
+  void set_latency(std::chrono::microseconds latency, std::chrono::microseconds jitter)
+  {
+    latency_us_ = latency.count();
+    jitter_us_ = jitter.count();
+  }
+
+  // Drops every connection after this many commands in total, 0 = never.
+  void set_disconnect_every(uint64_t commands) {disconnect_every_ = commands;}
+
+  // Closes every client socket, as a daemon restart would. The daemon keeps
+  // listening, so clients can connect again. Pin states are kept.
+  void disconnect_clients()
+  {
+    std::lock_guard<std::mutex> lock(clients_mutex_);
+    drop_connections();
+    disconnects_++;
+  }
+
+  // Sets an input level and reports the change to every notification
+  // handle watching the pin, with the daemon tick in microseconds.
+  void inject_edge(unsigned gpio, unsigned level)
+  {
+    if (gpio >= 32)
+    {
+      return;
+    }
+    std::lock_guard<std::mutex> lock(notify_mutex_);
+    const uint32_t bit = 1u << gpio;
+    const uint32_t levels = level ? bank1_.fetch_or(bit) | bit : bank1_.fetch_and(~bit) & ~bit;
+    Report report{0, 0, tick(), levels};
+    for (Notification & notification : notifications_)
+    {
+      if (notification.fd >= 0 && (notification.bits & bit))
+      {
+        report.seqno = notification.seqno++;
+        send(notification.fd, &report, sizeof(report), MSG_NOSIGNAL);
+      }
+    }
+  }
+
+  int mode(unsigned gpio) const {return gpio < MAX_GPIO ? pins_[gpio].mode.load() : -1;}
+  int level(unsigned gpio) const {return gpio < 32 ? (bank1_.load() >> gpio) & 1 : 0;}
+  // Software or hardware PWM duty, in the units the client last used.
+  int duty(unsigned gpio) const {return gpio < MAX_GPIO ? pins_[gpio].duty.load() : -1;}
+  uint64_t commands() const {return commands_;}
+  uint64_t disconnects() const {return disconnects_;}
+
+private:
+  struct Message
+  {
+    uint32_t command;
+    uint32_t p1;
+    uint32_t p2;
+    uint32_t p3;
+  };
+
+  // Same layout as gpioReport_t.
+  struct Report
+  {
+    uint16_t seqno;
+    uint16_t flags;
+    uint32_t tick;
+    uint32_t level;
+  };
+
+  struct Pin
+  {
+    std::atomic<int> mode{0};
+    std::atomic<int> duty{0};
+    std::atomic<int> range{255};
+    std::atomic<int> frequency{800};
+  };
+
+  struct Notification
+  {
+    int fd = -1;
+    uint32_t bits = 0;
+    uint16_t seqno = 0;
+  };
+
+  struct Client
+  {
+    int fd = -1;
+    std::thread thread;
+    std::atomic<bool> done{false};
+  };
+
+  int listen_fd_ = -1;
+  uint16_t port_ = 0;
+  std::atomic<bool> running_{false};
+  std::thread acceptor_;
+  std::chrono::steady_clock::time_point start_time_;
+
+  std::mutex clients_mutex_;
+  std::list<std::unique_ptr<Client>> clients_;
+
+  Pin pins_[MAX_GPIO];
+  std::atomic<uint32_t> bank1_{0};
+  std::mutex notify_mutex_;
+  Notification notifications_[MAX_NOTIFY];
+
+  std::atomic<int64_t> latency_us_{0};
+  std::atomic<int64_t> jitter_us_{0};
+  std::atomic<uint64_t> disconnect_every_{0};
+  std::atomic<uint64_t> commands_{0};
+  std::atomic<uint64_t> disconnects_{0};
+
+  uint32_t tick() const
+  {
+    return static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::microseconds>(
+             std::chrono::steady_clock::now() - start_time_).count());
+  }
+
+  // Called with clients_mutex_ held.
+  void drop_connections()
+  {
+    for (auto & client : clients_)
+    {
+      if (!client->done)
+      {
+        shutdown(client->fd, SHUT_RDWR);
+      }
+    }
+  }
+
+  static bool receive(int fd, void * buffer, size_t size)
+  {
+    char * bytes = static_cast<char *>(buffer);
+    while (size > 0)
+    {
+      ssize_t received = recv(fd, bytes, size, 0);
+      if (received <= 0)
+      {
+        return false;
+      }
+      bytes += received;
+      size -= static_cast<size_t>(received);
+    }
+    return true;
+  }
+
+  void accept_loop()
+  {
+    while (running_)
+    {
+      int fd = accept(listen_fd_, nullptr, nullptr);
+      if (fd < 0)
+      {
+        continue;
+      }
+      int nodelay = 1;
+      setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+
+      std::lock_guard<std::mutex> lock(clients_mutex_);
+      for (auto it = clients_.begin(); it != clients_.end(); )
+      {
+        if ((*it)->done)
+        {
+          (*it)->thread.join();
+          it = clients_.erase(it);
+        }
+        else
+        {
+          ++it;
+        }
+      }
+      clients_.push_back(std::make_unique<Client>());
+      Client * client = clients_.back().get();
+      client->fd = fd;
+      client->thread = std::thread(&FakePigpiod::serve, this, client);
+    }
+  }
+
+  // One thread per connection, like pigpiod. After NOIB the socket only
+  // carries reports, so the thread just waits for it to close.
+  void serve(Client * client)
+  {
+    std::minstd_rand random(static_cast<unsigned>(client->fd));
+    int handle = -1;
+    Message message;
+    while (receive(client->fd, &message, sizeof(message)))
+    {
+      uint32_t extension = 0;
+      if (message.command == HP && message.p3 == sizeof(extension))
+      {
+        if (!receive(client->fd, &extension, sizeof(extension)))
+        {
+          break;
+        }
+      }
+
+      const int64_t jitter = jitter_us_;
+      const int64_t delay = latency_us_ +
+        (jitter > 0 ? std::uniform_int_distribution<int64_t>(0, jitter)(random) : 0);
+      if (delay > 0)
+      {
+        std::this_thread::sleep_for(std::chrono::microseconds(delay));
+      }
+
+      int result;
+      if (message.command == NOIB)
+      {
+        handle = open_notification(client->fd);
+        result = handle;
+      }
+      else
+      {
+        result = execute(message, extension);
+      }
+      message.p3 = static_cast<uint32_t>(result);
+      if (send(client->fd, &message, sizeof(message), MSG_NOSIGNAL) != sizeof(message))
+      {
+        break;
+      }
+
+      const uint64_t every = disconnect_every_;
+      if (++commands_ % (every > 0 ? every : UINT64_MAX) == 0)
+      {
+        disconnect_clients();
+      }
+    }
+
+    if (handle >= 0)
+    {
+      close_notification(handle, client->fd);
+    }
+    // done before close, so drop_connections never shuts down a reused fd.
+    {
+      std::lock_guard<std::mutex> lock(clients_mutex_);
+      client->done = true;
+    }
+    close(client->fd);
+  }
+
+  int execute(const Message & message, uint32_t extension)
+  {
+    switch (message.command)
+    {
+      case BR1:
+        return static_cast<int>(bank1_.load());
+      case TICK:
+        return static_cast<int>(tick());
+      case NB:
+      case NP:
+      case NC:
+        return update_notification(message.command, message.p1, message.p2);
+      default:
+        break;
+    }
+
+    const unsigned gpio = message.p1;
+    if (gpio >= MAX_GPIO)
+    {
+      return BAD_COMMAND;
+    }
+    Pin & pin = pins_[gpio];
+    const int value = static_cast<int>(message.p2);
+    switch (message.command)
+    {
+      case MODES:
+        pin.mode = value;
+        return 0;
+      case MODEG:
+        return pin.mode;
+      case READ:
+        return level(gpio);
+      case WRITE:
+        pin.duty = value ? pin.range.load() : 0;
+        set_level(gpio, message.p2);
+        return 0;
+      case PWM:
+        if (value > pin.range)
+        {
+          return BAD_COMMAND;
+        }
+        pin.duty = value;
+        return 0;
+      case GDC:
+        return pin.duty;
+      case PRS:
+        // pigpiod answers the real range, 250 at the default 800 Hz.
+        pin.range = value;
+        return 250;
+      case PRG:
+        return pin.range;
+      case PFS:
+        pin.frequency = value;
+        return value;
+      case PFG:
+        return pin.frequency;
+      case HP:
+        pin.frequency = value;
+        pin.duty = static_cast<int>(extension);
+        return 0;
+      default:
+        return BAD_COMMAND;
+    }
+  }
+
+  // Outputs change the bank level without a report; pigpiod reports them
+  // too, but only watched pins, and the encoders are inputs.
+  void set_level(unsigned gpio, unsigned level)
+  {
+    if (gpio >= 32)
+    {
+      return;
+    }
+    const uint32_t bit = 1u << gpio;
+    if (level)
+    {
+      bank1_.fetch_or(bit);
+    }
+    else
+    {
+      bank1_.fetch_and(~bit);
+    }
+  }
+
+  int open_notification(int fd)
+  {
+    std::lock_guard<std::mutex> lock(notify_mutex_);
+    for (unsigned handle = 0; handle < MAX_NOTIFY; handle++)
+    {
+      if (notifications_[handle].fd < 0)
+      {
+        notifications_[handle] = Notification();
+        notifications_[handle].fd = fd;
+        return static_cast<int>(handle);
+      }
+    }
+    return NO_HANDLE;
+  }
+
+  int update_notification(uint32_t command, uint32_t handle, uint32_t bits)
+  {
+    std::lock_guard<std::mutex> lock(notify_mutex_);
+    if (handle >= MAX_NOTIFY || notifications_[handle].fd < 0)
+    {
+      return BAD_HANDLE;
+    }
+    Notification & notification = notifications_[handle];
+    if (command == NB)
+    {
+      notification.bits = bits;
+    }
+    else if (command == NP)
+    {
+      notification.bits = 0;
+    }
+    else
+    {
+      shutdown(notification.fd, SHUT_RDWR);
+      notification = Notification();
+    }
+    return 0;
+  }
+
+  // Only if NC has not already given the handle to another client.
+  void close_notification(int handle, int fd)
+  {
+    std::lock_guard<std::mutex> lock(notify_mutex_);
+    if (notifications_[handle].fd == fd)
+    {
+      notifications_[handle] = Notification();
+    }
+  }
+};
+
+#ifdef PI_CMD_NOIB
+static_assert(FakePigpiod::MODES == PI_CMD_MODES && FakePigpiod::WRITE == PI_CMD_WRITE, "pigpio command numbers");
+static_assert(FakePigpiod::PWM == PI_CMD_PWM && FakePigpiod::GDC == PI_CMD_GDC, "pigpio command numbers");
+static_assert(FakePigpiod::HP == PI_CMD_HP && FakePigpiod::NOIB == PI_CMD_NOIB, "pigpio command numbers");
+static_assert(FakePigpiod::NB == PI_CMD_NB && FakePigpiod::NC == PI_CMD_NC, "pigpio command numbers");
+static_assert(FakePigpiod::BAD_HANDLE == PI_BAD_HANDLE && FakePigpiod::NO_HANDLE == PI_NO_HANDLE, "pigpio errors");
+#endif
+
+#endif  // DIFFDRIVE_MINI_OCEBOT__FAKE_PIGPIOD_HPP_
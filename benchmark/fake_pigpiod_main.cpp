@@ -0,0 +1,82 @@
+// Runs FakePigpiod as a standalone daemon, for pointing a ros2_control
+// launch (gpio_backend pigpiod, gpio_device 127.0.0.1:<port>) or pigs-like
+// tools at it without a Raspberry Pi.
+//
+//   fake_pigpiod [--port=8888] [--latency_us=0] [--jitter_us=0]
+//                [--disconnect_every=0] [--edge_pin=-1] [--edge_rate=0]
+//
+// With edge_pin and edge_rate set, the pin toggles edge_rate times per
+// second, like a spinning single-channel encoder.
+
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#include "fake_pigpiod.hpp"
+
+namespace
+{
+volatile std::sig_atomic_t stop_requested = 0;
+
+void request_stop(int)
+{
+  stop_requested = 1;
+}
+
+// Value of --name=value, or the default.
+long option(int argc, char ** argv, const char * name, long default_value)
+{
+  const std::string prefix = std::string("--") + name + "=";
+  for (int i = 1; i < argc; i++)
+  {
+    if (std::strncmp(argv[i], prefix.c_str(), prefix.size()) == 0)
+    {
+      return std::strtol(argv[i] + prefix.size(), nullptr, 10);
+    }
+  }
+  return default_value;
+}
+}  // namespace
+
+int main(int argc, char ** argv)
+{
+  std::signal(SIGINT, request_stop);
+  std::signal(SIGTERM, request_stop);
+
+  FakePigpiod daemon;
+  if (!daemon.start(static_cast<uint16_t>(option(argc, argv, "port", 8888))))
+  {
+    std::perror("fake_pigpiod: cannot listen");
+    return 1;
+  }
+  daemon.set_latency(
+    std::chrono::microseconds(option(argc, argv, "latency_us", 0)),
+    std::chrono::microseconds(option(argc, argv, "jitter_us", 0)));
+  daemon.set_disconnect_every(static_cast<uint64_t>(option(argc, argv, "disconnect_every", 0)));
+  const long edge_pin = option(argc, argv, "edge_pin", -1);
+  const long edge_rate = option(argc, argv, "edge_rate", 0);
+  std::printf("fake_pigpiod listening on 127.0.0.1:%u\n", daemon.port());
+  std::fflush(stdout);
+
+  const auto edge_period = std::chrono::nanoseconds(edge_rate > 0 ? 1000000000 / edge_rate : 100000000);
+  auto next_edge = std::chrono::steady_clock::now();
+  unsigned level = 0;
+  while (!stop_requested)
+  {
+    next_edge += edge_period;
+    std::this_thread::sleep_until(next_edge);
+    if (edge_pin >= 0 && edge_rate > 0)
+    {
+      level ^= 1;
+      daemon.inject_edge(static_cast<unsigned>(edge_pin), level);
+    }
+  }
+
+  std::printf(
+    "fake_pigpiod served %lu commands, dropped the clients %lu times\n",
+    static_cast<unsigned long>(daemon.commands()), static_cast<unsigned long>(daemon.disconnects()));
+  daemon.stop();
+  return 0;
+}
@@ -14,20 +14,64 @@
 
 #include "diffdrive_mini_ocebot/diffbot_system.hpp"
 
+#include <algorithm>
 #include <chrono>
 #include <cmath>
 #include <cstddef>
 #include <cstdlib>
 #include <limits>
 #include <memory>
+#include <string>
 #include <vector>
 
 #include "hardware_interface/types/hardware_interface_type_values.hpp"
 #include "rclcpp/rclcpp.hpp"
-#include <pigpiod_if2.h>
+#include "diffdrive_mini_ocebot/gpio_backend_factory.hpp"
 
 namespace diffdrive_mini_ocebot
 {
+namespace
+{
+std::string get_parameter(
+  const hardware_interface::HardwareInfo & info, const std::string & name,
+  const std::string & default_value)
+{
+  auto it = info.hardware_parameters.find(name);
+  return it == info.hardware_parameters.end() ? default_value : it->second;
+}
+
+// A joint <param>, else the hardware parameter legacy_name if given.
+std::string get_joint_parameter(
+  const hardware_interface::HardwareInfo & info, const hardware_interface::ComponentInfo & joint,
+  const std::string & name, const std::string & legacy_name, const std::string & default_value)
+{
+  auto it = joint.parameters.find(name);
+  if (it != joint.parameters.end())
+  {
+    return it->second;
+  }
+  return legacy_name.empty() ? default_value : get_parameter(info, legacy_name, default_value);
+}
+
+const char * const kDiagnosticMetricNames[] = {
+  "read_period", "write_duration", "backend_call", "encoder_callback"};
+const char * const kDiagnosticStatNames[] = {"p50_us", "p99_us", "p999_us", "max_us"};
+const double kDiagnosticQuantiles[] = {0.5, 0.99, 0.999};
+
+// Sample period of the system identification record, in seconds.
+const double kSystemIdPeriod = 0.002;
+
+// write() periods averaged before they are compared with update_rate. The
+// first one after activation is skipped, it can include the activation.
+const unsigned kWritePeriodSamples = 10;
+}  // namespace
+
+DiffBotSystemHardware::~DiffBotSystemHardware()
+{
+  write_watchdog_.stop();
+  stop_inner_loop();
+}
+
 hardware_interface::CallbackReturn DiffBotSystemHardware::on_init(
   const hardware_interface::HardwareInfo & info)
 {
@@ -38,18 +82,225 @@ hardware_interface::CallbackReturn DiffBotSystemHardware::on_init(
     return hardware_interface::CallbackReturn::ERROR;
   }
 
-  cfg_.left_wheel_name = info_.hardware_parameters["left_wheel_name"];
-  cfg_.right_wheel_name = info_.hardware_parameters["right_wheel_name"];
-  cfg_.left_wheel_pin = std::stoi(info_.hardware_parameters["left_wheel_pin"]);
-  cfg_.right_wheel_pin = std::stoi(info_.hardware_parameters["right_wheel_pin"]);
-  cfg_.left_direction_pin = std::stoi(info_.hardware_parameters["left_direction_pin"]);
-  cfg_.right_direction_pin = std::stoi(info_.hardware_parameters["right_direction_pin"]);
-  cfg_.left_enc_pin = std::stoi(info_.hardware_parameters["left_encoder_pin"]);
-  cfg_.right_enc_pin = std::stoi(info_.hardware_parameters["right_encoder_pin"]);
-  cfg_.enc_counts_per_rev = std::stoul(info_.hardware_parameters["enc_counts_per_rev"]);
-  
-  wheel_left_.setup(cfg_.left_wheel_name, cfg_.enc_counts_per_rev);
-  wheel_right_.setup(cfg_.right_wheel_name, cfg_.enc_counts_per_rev);
+  cfg_.gpio_backend = get_parameter(info_, "gpio_backend", "pigpiod");
+  cfg_.gpio_device = get_parameter(info_, "gpio_device", "");
+  cfg_.async_io = get_parameter(info_, "async_io", "false") == "true";
+  cfg_.io_poll_period_us = std::stoi(get_parameter(info_, "io_poll_period_us", "200"));
+  cfg_.edge_velocity = get_parameter(info_, "velocity_estimation", "mt") == "mt";
+  cfg_.velocity_edge_threshold = std::stoul(get_parameter(info_, "velocity_edge_threshold", "10"));
+  cfg_.velocity_timeout = std::stod(get_parameter(info_, "velocity_timeout", "0.5"));
+  cfg_.closed_loop = get_parameter(info_, "control_mode", "open_loop") == "pid";
+  cfg_.pid_kp = std::stod(get_parameter(info_, "pid_kp", "0"));
+  cfg_.pid_ki = std::stod(get_parameter(info_, "pid_ki", "0"));
+  cfg_.pid_kd = std::stod(get_parameter(info_, "pid_kd", "0"));
+  cfg_.pid_kff = std::stod(get_parameter(info_, "pid_kff", "10"));
+  cfg_.pid_friction_duty = std::stod(get_parameter(info_, "pid_friction_duty", "0"));
+  cfg_.pid_i_clamp = std::stod(get_parameter(info_, "pid_i_clamp", "50"));
+  cfg_.pid_output_limit = std::stod(get_parameter(info_, "pid_output_limit", "115"));
+  cfg_.inner_loop_rate = std::stod(get_parameter(info_, "inner_loop_rate", "0"));
+  cfg_.realtime.priority = std::stoi(get_parameter(info_, "rt_priority", "0"));
+  cfg_.realtime.cpu = std::stoi(get_parameter(info_, "rt_cpu", "-1"));
+  cfg_.realtime.lock_memory = get_parameter(info_, "lock_memory", "false") == "true";
+  cfg_.sim_motor_gain = std::stod(get_parameter(info_, "sim_motor_gain", "20"));
+  cfg_.sim_motor_time_constant = std::stod(get_parameter(info_, "sim_motor_time_constant", "0.05"));
+  cfg_.sim_motor_deadband = std::stod(get_parameter(info_, "sim_motor_deadband", "0.1"));
+  cfg_.sim_time_scale = std::stod(get_parameter(info_, "sim_time_scale", "1.0"));
+  cfg_.diagnostics_period = std::stod(get_parameter(info_, "diagnostics_period", "1.0"));
+  cfg_.pwm_hardware = get_parameter(info_, "pwm_mode", "software") == "hardware";
+  cfg_.pwm_frequency = std::stoul(get_parameter(info_, "pwm_frequency", "0"));
+  cfg_.pwm_range = std::stoul(get_parameter(info_, "pwm_range", "255"));
+  cfg_.breakaway_duty = std::stod(get_parameter(info_, "breakaway_duty", "0"));
+  cfg_.breakaway_time_ms = std::stod(get_parameter(info_, "breakaway_time_ms", "5"));
+  cfg_.min_duty = std::stod(get_parameter(info_, "min_duty", "0"));
+  cfg_.duty_table = get_parameter(info_, "velocity_to_duty", "linear") == "table";
+  cfg_.duty_table_file = get_parameter(info_, "duty_table_file", "");
+  cfg_.duty_calibration = get_parameter(info_, "duty_calibration", "false") == "true";
+  cfg_.calibration_steps = std::stoul(get_parameter(info_, "calibration_steps", "16"));
+  cfg_.calibration_settle_time = std::stod(get_parameter(info_, "calibration_settle_time", "1.0"));
+  cfg_.calibration_measure_time = std::stod(get_parameter(info_, "calibration_measure_time", "1.0"));
+  cfg_.system_identification = get_parameter(info_, "system_identification", "false") == "true";
+  cfg_.system_id_file = get_parameter(info_, "system_id_file", "");
+  cfg_.update_rate = std::stod(get_parameter(info_, "update_rate", "10"));
+  cfg_.write_deadline_ms = std::stod(get_parameter(info_, "write_deadline_ms", "0"));
+  cfg_.wheel_separation = std::stod(get_parameter(info_, "wheel_separation", "0"));
+  cfg_.wheel_radius = std::stod(get_parameter(info_, "wheel_radius", "0"));
+  cfg_.event_log = get_parameter(info_, "event_log", "");
+  cfg_.event_log_capacity = std::stoul(get_parameter(info_, "event_log_capacity", "1048576"));
+
+  if (info_.joints.size() > Controller::MAX_MOTORS)
+  {
+    RCLCPP_FATAL(
+      rclcpp::get_logger("DiffBotSystemHardware"), "%zu joints given, at most %zu supported.",
+      info_.joints.size(), Controller::MAX_MOTORS);
+    return hardware_interface::CallbackReturn::ERROR;
+  }
+
+  // Every joint is one motor with its own pins, read from the joint's
+  // <param> entries. The left_*/right_* hardware parameters of two-wheel
+  // descriptions still apply to the joints named by left_wheel_name and
+  // right_wheel_name.
+  const std::string left_wheel_name = get_parameter(info_, "left_wheel_name", "");
+  const std::string right_wheel_name = get_parameter(info_, "right_wheel_name", "");
+  cfg_.wheels.clear();
+  for (const hardware_interface::ComponentInfo & joint : info_.joints)
+  {
+    const std::string prefix =
+      joint.name == left_wheel_name ? "left_" : joint.name == right_wheel_name ? "right_" : "";
+    const std::string pwm_pin = get_joint_parameter(info_, joint, "pwm_pin", prefix + "wheel_pin", "");
+    const std::string direction_pin =
+      get_joint_parameter(info_, joint, "direction_pin", prefix + "direction_pin", "");
+    const std::string encoder_pin = get_joint_parameter(info_, joint, "encoder_pin", prefix + "encoder_pin", "");
+    const std::string counts_per_rev =
+      get_joint_parameter(info_, joint, "enc_counts_per_rev", "enc_counts_per_rev", "");
+    if (pwm_pin.empty() || direction_pin.empty() || encoder_pin.empty() || counts_per_rev.empty())
+    {
+      RCLCPP_FATAL(
+        rclcpp::get_logger("DiffBotSystemHardware"),
+        "Joint '%s' needs pwm_pin, direction_pin, encoder_pin and enc_counts_per_rev.", joint.name.c_str());
+      return hardware_interface::CallbackReturn::ERROR;
+    }
+
+    // Legacy wheels keep their fixed polarity: the left direction pin is
+    // high for reverse, the right one high for forward.
+    const std::string side = get_joint_parameter(
+      info_, joint, "side", "", prefix.empty() ? "" : prefix.substr(0, prefix.size() - 1));
+    WheelConfig wheel;
+    wheel.name = joint.name;
+    wheel.pins.pwm = std::stoi(pwm_pin);
+    wheel.pins.direction = std::stoi(direction_pin);
+    wheel.pins.reverse_level =
+      std::stoi(get_joint_parameter(info_, joint, "reverse_level", "", prefix == "right_" ? "0" : "1"));
+    wheel.pins.encoder_a = std::stoi(encoder_pin);
+    wheel.pins.encoder_b = std::stoi(get_joint_parameter(info_, joint, "encoder_b_pin", prefix + "encoder_b_pin", "-1"));
+    wheel.enc_counts_per_rev = std::stoul(counts_per_rev);
+    wheel.side = side == "left" ? EdgeOdometry::LEFT : side == "right" ? EdgeOdometry::RIGHT : 0;
+    cfg_.wheels.push_back(wheel);
+  }
+
+  // enc_counts_per_rev counts both edges of the A channel. Quadrature decoding
+  // adds the B edges, doubling the counts per revolution.
+  std::vector<std::string> wheel_names;
+  std::vector<unsigned> wheel_counts_per_rev;
+  for (const WheelConfig & wheel : cfg_.wheels)
+  {
+    wheel_names.push_back(wheel.name);
+    wheel_counts_per_rev.push_back(wheel.enc_counts_per_rev * (wheel.pins.encoder_b >= 0 ? 2 : 1));
+  }
+  wheels_.setup(wheel_names, wheel_counts_per_rev);
+  pids_.assign(wheels_.size(), WheelPid());
+  drive_signs_.assign(wheels_.size(), 1);
+  duty_tables_.assign(wheels_.size(), DutyVelocityTable());
+  for (size_t i = 0; i < wheels_.size(); i++)
+  {
+    wheels_.estimators[i].setup(wheels_.rads_per_count[i], cfg_.velocity_edge_threshold, cfg_.velocity_timeout);
+    pids_[i].setup(
+      cfg_.pid_kp, cfg_.pid_ki, cfg_.pid_kd, cfg_.pid_kff, cfg_.pid_friction_duty, cfg_.pid_i_clamp,
+      cfg_.pid_output_limit);
+  }
+
+  if (odometry_enabled())
+  {
+    std::vector<int> sides;
+    bool has_side[2] = {false, false};
+    for (const WheelConfig & wheel : cfg_.wheels)
+    {
+      if (wheel.side == 0)
+      {
+        RCLCPP_FATAL(
+          rclcpp::get_logger("DiffBotSystemHardware"),
+          "Joint '%s' needs side left or right for the odometry.", wheel.name.c_str());
+        return hardware_interface::CallbackReturn::ERROR;
+      }
+      // A single-channel encoder counts up whichever way the wheel turns, so
+      // reversing or turning on the spot would integrate as driving forward.
+      if (wheel.pins.encoder_b < 0)
+      {
+        RCLCPP_FATAL(
+          rclcpp::get_logger("DiffBotSystemHardware"),
+          "Joint '%s' needs encoder_b_pin for the odometry; single-channel encoders cannot tell direction.",
+          wheel.name.c_str());
+        return hardware_interface::CallbackReturn::ERROR;
+      }
+      sides.push_back(wheel.side);
+      has_side[wheel.side == EdgeOdometry::RIGHT] = true;
+    }
+    if (!has_side[0] || !has_side[1])
+    {
+      RCLCPP_FATAL(
+        rclcpp::get_logger("DiffBotSystemHardware"), "The odometry needs wheels on both sides.");
+      return hardware_interface::CallbackReturn::ERROR;
+    }
+    odometry_.setup(wheels_.rads_per_count, sides, cfg_.wheel_radius, cfg_.wheel_separation);
+    wheels_.enable_tracks();
+  }
+
+  if ((cfg_.duty_table || cfg_.duty_calibration) && cfg_.duty_table_file.empty())
+  {
+    RCLCPP_FATAL(
+      rclcpp::get_logger("DiffBotSystemHardware"),
+      "velocity_to_duty=table and duty_calibration need duty_table_file.");
+    return hardware_interface::CallbackReturn::ERROR;
+  }
+  if (cfg_.duty_table && !load_wheel_duty_tables())
+  {
+    if (!cfg_.duty_calibration)
+    {
+      RCLCPP_FATAL(
+        rclcpp::get_logger("DiffBotSystemHardware"),
+        "Could not load a duty table for every wheel from '%s'. Run with duty_calibration=true first.",
+        cfg_.duty_table_file.c_str());
+      return hardware_interface::CallbackReturn::ERROR;
+    }
+    RCLCPP_WARN(
+      rclcpp::get_logger("DiffBotSystemHardware"),
+      "No usable duty table in '%s' yet; the calibration sweep will create it.", cfg_.duty_table_file.c_str());
+  }
+
+  if (cfg_.system_identification && cfg_.system_id_file.empty())
+  {
+    RCLCPP_FATAL(
+      rclcpp::get_logger("DiffBotSystemHardware"), "system_identification needs system_id_file.");
+    return hardware_interface::CallbackReturn::ERROR;
+  }
+
+  // write() comes once per update period, so a deadline that is not
+  // clearly longer trips on ordinary scheduling jitter and keeps the motors
+  // braked.
+  const double write_period_ms = cfg_.update_rate > 0 ? 1000.0 / cfg_.update_rate : 0;
+  if (cfg_.write_deadline_ms > 0 && cfg_.write_deadline_ms <= write_period_ms)
+  {
+    RCLCPP_FATAL(
+      rclcpp::get_logger("DiffBotSystemHardware"),
+      "write_deadline_ms %.0f is not longer than the %.0f ms update period; use at least twice the period.",
+      cfg_.write_deadline_ms, write_period_ms);
+    return hardware_interface::CallbackReturn::ERROR;
+  }
+  if (cfg_.write_deadline_ms > 0 && cfg_.write_deadline_ms < 2 * write_period_ms)
+  {
+    RCLCPP_WARN(
+      rclcpp::get_logger("DiffBotSystemHardware"),
+      "write_deadline_ms %.0f leaves less than one update period (%.0f ms) of slack; late cycles will brake.",
+      cfg_.write_deadline_ms, write_period_ms);
+  }
+
+  // Without a thread of its own to end it, a kick lasts until the next
+  // write(), a whole update period at full breakaway duty.
+  if (
+    cfg_.breakaway_duty > 0 && !cfg_.async_io && cfg_.inner_loop_rate <= 0 &&
+    cfg_.breakaway_time_ms < write_period_ms)
+  {
+    RCLCPP_WARN(
+      rclcpp::get_logger("DiffBotSystemHardware"),
+      "breakaway_time_ms %.1f is shorter than the %.0f ms update period; kicks will last a whole period. "
+      "Enable async_io or inner_loop_rate to end them on time.", cfg_.breakaway_time_ms, write_period_ms);
+  }
+
+  if (cfg_.pwm_range == 0 || cfg_.pwm_range > 40000)
+  {
+    RCLCPP_FATAL(
+      rclcpp::get_logger("DiffBotSystemHardware"), "pwm_range %u is outside 1-40000.", cfg_.pwm_range);
+    return hardware_interface::CallbackReturn::ERROR;
+  }
 
   for (const hardware_interface::ComponentInfo & joint : info_.joints)
   {
@@ -105,16 +356,40 @@ hardware_interface::CallbackReturn DiffBotSystemHardware::on_init(
 std::vector<hardware_interface::StateInterface> DiffBotSystemHardware::export_state_interfaces()
 {
   std::vector<hardware_interface::StateInterface> state_interfaces;
-  
-  state_interfaces.emplace_back(hardware_interface::StateInterface(
-    wheel_left_.name, hardware_interface::HW_IF_POSITION, &wheel_left_.pos));
-  state_interfaces.emplace_back(hardware_interface::StateInterface(
-    wheel_left_.name, hardware_interface::HW_IF_VELOCITY, &wheel_left_.vel));
 
-  state_interfaces.emplace_back(hardware_interface::StateInterface(
-    wheel_right_.name, hardware_interface::HW_IF_POSITION, &wheel_right_.pos));
-  state_interfaces.emplace_back(hardware_interface::StateInterface(
-    wheel_right_.name, hardware_interface::HW_IF_VELOCITY, &wheel_right_.vel));
+  for (size_t i = 0; i < wheels_.size(); i++)
+  {
+    state_interfaces.emplace_back(hardware_interface::StateInterface(
+      wheels_.names[i], hardware_interface::HW_IF_POSITION, &wheels_.pos[i]));
+    state_interfaces.emplace_back(hardware_interface::StateInterface(
+      wheels_.names[i], hardware_interface::HW_IF_VELOCITY, &wheels_.vel[i]));
+  }
+
+  if (cfg_.diagnostics_period > 0)
+  {
+    for (size_t metric = 0; metric < kDiagnosticMetrics; metric++)
+    {
+      for (size_t stat = 0; stat < kDiagnosticStats; stat++)
+      {
+        state_interfaces.emplace_back(hardware_interface::StateInterface(
+          info_.name, std::string(kDiagnosticMetricNames[metric]) + "_" + kDiagnosticStatNames[stat],
+          &diagnostics_[metric][stat]));
+      }
+    }
+  }
+
+  if (cfg_.write_deadline_ms > 0)
+  {
+    state_interfaces.emplace_back(hardware_interface::StateInterface(
+      info_.name, "write_deadline_misses", &watchdog_misses_));
+  }
+
+  if (odometry_enabled())
+  {
+    state_interfaces.emplace_back(hardware_interface::StateInterface(info_.name, "pose_x", &pose_[0]));
+    state_interfaces.emplace_back(hardware_interface::StateInterface(info_.name, "pose_y", &pose_[1]));
+    state_interfaces.emplace_back(hardware_interface::StateInterface(info_.name, "pose_theta", &pose_[2]));
+  }
 
   return state_interfaces;
 }
@@ -123,11 +398,11 @@ std::vector<hardware_interface::CommandInterface> DiffBotSystemHardware::export_
 {
   std::vector<hardware_interface::CommandInterface> command_interfaces;
 
-  command_interfaces.emplace_back(hardware_interface::CommandInterface(
-    wheel_left_.name, hardware_interface::HW_IF_VELOCITY, &wheel_left_.cmd));
-
-  command_interfaces.emplace_back(hardware_interface::CommandInterface(
-    wheel_right_.name, hardware_interface::HW_IF_VELOCITY, &wheel_right_.cmd));
+  for (size_t i = 0; i < wheels_.size(); i++)
+  {
+    command_interfaces.emplace_back(hardware_interface::CommandInterface(
+      wheels_.names[i], hardware_interface::HW_IF_VELOCITY, &wheels_.cmd[i]));
+  }
 
   return command_interfaces;
 }
@@ -135,30 +410,228 @@ std::vector<hardware_interface::CommandInterface> DiffBotSystemHardware::export_
 hardware_interface::CallbackReturn DiffBotSystemHardware::on_configure(
   const rclcpp_lifecycle::State & /*previous_state*/)
 {
-  gpio_controller_.setup(cfg_.left_enc_pin, cfg_.right_enc_pin, cfg_.left_wheel_pin, cfg_.right_wheel_pin, cfg_.left_direction_pin, cfg_.right_direction_pin);
-  gpio_controller_.register_encoders(wheel_left_.enc, wheel_right_.enc);
+  std::unique_ptr<GpioBackend> backend = make_gpio_backend(cfg_.gpio_backend, cfg_.gpio_device);
+  if (!backend)
+  {
+    RCLCPP_FATAL(
+      rclcpp::get_logger("DiffBotSystemHardware"),
+      "GPIO backend '%s' is unknown or was not compiled in.", cfg_.gpio_backend.c_str());
+    return hardware_interface::CallbackReturn::ERROR;
+  }
+
+  SimMotorBackend * plant = dynamic_cast<SimMotorBackend *>(backend.get());
+  if (plant != nullptr)
+  {
+    setup_sim_motors(*plant);
+  }
+
+  ReplayBackend * replay = dynamic_cast<ReplayBackend *>(backend.get());
+  if (replay != nullptr)
+  {
+    replay->time_scale = cfg_.sim_time_scale;
+  }
+
+  SimBackend * sim = dynamic_cast<SimBackend *>(backend.get());
+  sim_clock_ = (sim != nullptr && cfg_.sim_time_scale <= 0) ? sim : nullptr;
+
+  if (!cfg_.event_log.empty())
+  {
+    if (replay != nullptr && cfg_.event_log == cfg_.gpio_device)
+    {
+      RCLCPP_FATAL(
+        rclcpp::get_logger("DiffBotSystemHardware"),
+        "Event log '%s' is also the replay source.", cfg_.event_log.c_str());
+      return hardware_interface::CallbackReturn::ERROR;
+    }
+    if (!event_log_.create(cfg_.event_log, cfg_.event_log_capacity))
+    {
+      RCLCPP_FATAL(
+        rclcpp::get_logger("DiffBotSystemHardware"),
+        "Could not create event log '%s' for %lu records.", cfg_.event_log.c_str(),
+        cfg_.event_log_capacity);
+      return hardware_interface::CallbackReturn::ERROR;
+    }
+    gpio_controller_.event_log = &event_log_;
+  }
+
+  cfg_.realtime.lock_process_memory();
+  backend->realtime = cfg_.realtime;
+  gpio_controller_.realtime = cfg_.realtime;
+  gpio_controller_.record_latency = cfg_.diagnostics_period > 0;
+
+  std::vector<MotorPins> pins;
+  for (const WheelConfig & wheel : cfg_.wheels)
+  {
+    pins.push_back(wheel.pins);
+  }
+  if (!gpio_controller_.setup(std::move(backend), pins))
+  {
+    RCLCPP_FATAL(
+      rclcpp::get_logger("DiffBotSystemHardware"),
+      "Could not connect to GPIO backend '%s'.", cfg_.gpio_backend.c_str());
+    return hardware_interface::CallbackReturn::ERROR;
+  }
+  if (cfg_.pwm_hardware || cfg_.pwm_frequency > 0 || cfg_.pwm_range != Controller::DEFAULT_PWM_RANGE)
+  {
+    int hardware_pins = gpio_controller_.configure_pwm(cfg_.pwm_frequency, cfg_.pwm_range, cfg_.pwm_hardware);
+    if (hardware_pins < 0)
+    {
+      RCLCPP_FATAL(
+        rclcpp::get_logger("DiffBotSystemHardware"),
+        "GPIO backend '%s' rejected PWM frequency %u / range %u.", cfg_.gpio_backend.c_str(),
+        cfg_.pwm_frequency, cfg_.pwm_range);
+      return hardware_interface::CallbackReturn::ERROR;
+    }
+    if (cfg_.pwm_hardware && static_cast<size_t>(hardware_pins) < pins.size())
+    {
+      RCLCPP_WARN(
+        rclcpp::get_logger("DiffBotSystemHardware"),
+        "Only %d of %zu motor pins are on hardware PWM (GPIO 12/18 and 13/19, one pin per channel); "
+        "the rest use software PWM.", hardware_pins, pins.size());
+    }
+  }
+
+  const double duty_scale =
+    static_cast<double>(gpio_controller_.pwm_range) / Controller::DEFAULT_PWM_RANGE;
+  gpio_controller_.kick_duty = static_cast<int>(std::lround(cfg_.breakaway_duty * duty_scale));
+  gpio_controller_.kick_duration_ns = static_cast<int64_t>(cfg_.breakaway_time_ms * 1e6);
+  gpio_controller_.min_duty = static_cast<int>(std::lround(cfg_.min_duty * duty_scale));
 
   return hardware_interface::CallbackReturn::SUCCESS;
 }
 
+// The backend connection is made in on_configure. Activation only arms the
+// encoders and threads on it, so switching controllers does not reconnect.
 hardware_interface::CallbackReturn DiffBotSystemHardware::on_activate(
   const rclcpp_lifecycle::State & /*previous_state*/)
 {
+  wheels_.reset();
+  odometry_.reset();
+  pose_[0] = 0;
+  pose_[1] = 0;
+  pose_[2] = 0;
+  WheelCommands stale_commands;
+  WheelStates stale_states;
+  command_slot_.take(stale_commands);
+  state_slot_.take(stale_states);
+
+  if (!gpio_controller_.register_encoders(wheels_.counts.get(), wheels_.edges.get()))
+  {
+    gpio_controller_.cancel_encoders();
+    RCLCPP_FATAL(
+      rclcpp::get_logger("DiffBotSystemHardware"),
+      "GPIO backend '%s' refused an encoder callback.", cfg_.gpio_backend.c_str());
+    return hardware_interface::CallbackReturn::ERROR;
+  }
+
+  if (cfg_.async_io)
+  {
+    gpio_controller_.start_io_thread(std::chrono::microseconds(cfg_.io_poll_period_us));
+  }
+
+  for (WheelPid & pid : pids_)
+  {
+    pid.reset();
+  }
+  std::fill(drive_signs_.begin(), drive_signs_.end(), 1);
+
+  read_period_hist_.reset();
+  write_duration_hist_.reset();
+  write_period_sum_ = 0;
+  write_period_samples_ = 0;
+  gpio_controller_.backend_latency.reset();
+  gpio_controller_.callback_latency.reset();
+  diagnostics_elapsed_ = 0;
+
+  if (cfg_.inner_loop_rate > 0)
+  {
+    start_inner_loop();
+  }
+
+  if (cfg_.duty_calibration || cfg_.system_identification)
+  {
+    start_experiments();
+  }
+
+  if (cfg_.write_deadline_ms > 0)
+  {
+    write_watchdog_.reset_stats();
+    watchdog_misses_ = 0;
+    write_watchdog_.start(
+      std::chrono::nanoseconds(static_cast<int64_t>(cfg_.write_deadline_ms * 1e6)),
+      &DiffBotSystemHardware::brake_on_missed_write, this, cfg_.realtime);
+  }
+
   return hardware_interface::CallbackReturn::SUCCESS;
 }
 
 hardware_interface::CallbackReturn DiffBotSystemHardware::on_deactivate(
   const rclcpp_lifecycle::State & /*previous_state*/)
 {
+  write_watchdog_.stop();
+  if (cfg_.write_deadline_ms > 0)
+  {
+    RCLCPP_INFO(
+      rclcpp::get_logger("DiffBotSystemHardware"),
+      "write() missed its %.0f ms deadline %lu times, longest stall %.1f ms.", cfg_.write_deadline_ms,
+      static_cast<unsigned long>(write_watchdog_.misses()), write_watchdog_.longest_stall_ns() / 1e6);
+  }
+  stop_experiments();
+  stop_inner_loop();
+
+  // Park the I/O thread before stopping the motors from here, then stop
+  // edge handling. The backend stays connected for the next activation.
+  gpio_controller_.stop_io_thread();
+  const int stopped[Controller::MAX_MOTORS] = {};
+  gpio_controller_.set_motor_values(stopped);
+  gpio_controller_.cancel_encoders();
+
   return hardware_interface::CallbackReturn::SUCCESS;
 }
 
 hardware_interface::CallbackReturn DiffBotSystemHardware::on_cleanup(
   const rclcpp_lifecycle::State & /*previous_state*/)
 {
-  RCLCPP_INFO(rclcpp::get_logger("DiffBotSystemHardware"), "Terminating connection to daemon... please wait...");
+  stop_experiments();
+  stop_inner_loop();
+
+  RCLCPP_INFO(
+    rclcpp::get_logger("DiffBotSystemHardware"), "Skipped %lu redundant GPIO calls.",
+    static_cast<unsigned long>(gpio_controller_.skipped_calls));
+  bool quadrature = false;
+  for (const WheelConfig & wheel : cfg_.wheels)
+  {
+    quadrature = quadrature || wheel.pins.encoder_b >= 0;
+  }
+  if (quadrature)
+  {
+    RCLCPP_INFO(
+      rclcpp::get_logger("DiffBotSystemHardware"), "Quadrature decoder saw %u missed edges.",
+      gpio_controller_.encoder_errors());
+  }
+  if (cfg_.async_io)
+  {
+    RCLCPP_INFO(
+      rclcpp::get_logger("DiffBotSystemHardware"),
+      "Command-to-pin latency over %lu commands: mean %.1f us, max %.1f us.",
+      static_cast<unsigned long>(gpio_controller_.io_latency.count.load()),
+      gpio_controller_.io_latency.mean_ns() / 1000.0,
+      gpio_controller_.io_latency.max_ns.load() / 1000.0);
+  }
+  RCLCPP_INFO(rclcpp::get_logger("DiffBotSystemHardware"), "Terminating connection to GPIO backend... please wait...");
 
   gpio_controller_.cleanup();
+  sim_clock_ = nullptr;
+
+  if (event_log_.recording())
+  {
+    RCLCPP_INFO(
+      rclcpp::get_logger("DiffBotSystemHardware"), "Recorded %lu events to '%s' (%lu overwritten).",
+      static_cast<unsigned long>(event_log_.size()), cfg_.event_log.c_str(),
+      static_cast<unsigned long>(event_log_.overwritten()));
+    gpio_controller_.event_log = nullptr;
+    event_log_.close();
+  }
 
   return hardware_interface::CallbackReturn::SUCCESS;
 }
@@ -166,30 +639,611 @@ hardware_interface::CallbackReturn DiffBotSystemHardware::on_cleanup(
 hardware_interface::return_type DiffBotSystemHardware::read(
   const rclcpp::Time & /*time*/, const rclcpp::Duration & period)
 {
+  watchdog_misses_ = static_cast<double>(write_watchdog_.misses());
+
+  if (cfg_.diagnostics_period > 0)
+  {
+    read_period_hist_.record(period.nanoseconds());
+    diagnostics_elapsed_ += period.seconds();
+    if (diagnostics_elapsed_ >= cfg_.diagnostics_period)
+    {
+      diagnostics_elapsed_ = 0;
+      update_diagnostics();
+    }
+  }
+
+  if (sim_clock_ != nullptr)
+  {
+    sim_clock_->advance(period.seconds());
+  }
+
+  if (inner_loop_running_)
+  {
+    WheelStates states;
+    if (state_slot_.take(states))
+    {
+      for (size_t i = 0; i < wheels_.size(); i++)
+      {
+        wheels_.pos[i] = states.pos[i];
+        wheels_.vel[i] = states.vel[i];
+      }
+      pose_[0] = states.x;
+      pose_[1] = states.y;
+      pose_[2] = states.theta;
+    }
+    return hardware_interface::return_type::OK;
+  }
+
   double delta_seconds = period.seconds();
 
-  float pos_prev = wheel_left_.pos;
-  wheel_left_.pos = wheel_left_.calc_enc_angle();
-  wheel_left_.vel = (wheel_left_.pos - pos_prev) / delta_seconds;
+  if (experiment_running_)
+  {
+    wheels_.update_from_counter(delta_seconds);
+    return hardware_interface::return_type::OK;
+  }
+
+  wheels_.update(delta_seconds, cfg_.edge_velocity);
 
-  pos_prev = wheel_right_.pos;
-  wheel_right_.pos = wheel_right_.calc_enc_angle();
-  wheel_right_.vel = (wheel_right_.pos - pos_prev) / delta_seconds;
+  if (odometry_enabled())
+  {
+    odometry_.integrate(wheels_.tracks.data());
+    pose_[0] = odometry_.x;
+    pose_[1] = odometry_.y;
+    pose_[2] = odometry_.theta;
+  }
 
   return hardware_interface::return_type::OK;
 }
 
 hardware_interface::return_type diffdrive_mini_ocebot ::DiffBotSystemHardware::write(
-  const rclcpp::Time & /*time*/, const rclcpp::Duration & /*period*/)
+  const rclcpp::Time & /*time*/, const rclcpp::Duration & period)
 {
-  int motor_l_counts_per_loop = wheel_left_.cmd * 10;
-  int motor_r_counts_per_loop = wheel_right_.cmd * 10;
+  ScopedLatency timing(cfg_.diagnostics_period > 0 ? &write_duration_hist_ : nullptr);
+  write_watchdog_.feed();
+
+  if (write_period_samples_ <= kWritePeriodSamples)
+  {
+    if (write_period_samples_++ > 0)
+    {
+      write_period_sum_ += period.seconds();
+    }
+    if (write_period_samples_ > kWritePeriodSamples)
+    {
+      check_write_period(1000.0 * write_period_sum_ / kWritePeriodSamples);
+    }
+  }
+
+  if (inner_loop_running_)
+  {
+    WheelCommands commands;
+    std::copy(wheels_.cmd.begin(), wheels_.cmd.end(), commands.cmd);
+    command_slot_.publish(commands);
+    return hardware_interface::return_type::OK;
+  }
 
-  gpio_controller_.set_motor_values(motor_l_counts_per_loop, motor_r_counts_per_loop);
+  command_motors(wheels_.cmd.data(), wheels_.vel.data(), period.seconds());
 
   return hardware_interface::return_type::OK;
 }
 
+void DiffBotSystemHardware::command_motors(const double * cmd, const double * vel, double delta_seconds)
+{
+  if (experiment_running_)
+  {
+    return;
+  }
+  if (write_watchdog_.tripped())
+  {
+    drive_all_motors(0);
+    return;
+  }
+
+  const size_t count = wheels_.size();
+  int duties[Controller::MAX_MOTORS] = {};
+  bool use_table = cfg_.duty_table;
+  for (size_t i = 0; i < count; i++)
+  {
+    use_table = use_table && duty_tables_[i].valid;
+  }
+
+  // Gains and limits are in duty steps of the default 0-255 range; a finer
+  // pwm_range keeps their meaning and gains the extra resolution.
+  const double duty_scale =
+    static_cast<double>(gpio_controller_.pwm_range) / Controller::DEFAULT_PWM_RANGE;
+
+  for (size_t i = 0; i < count; i++)
+  {
+    const double measured = cfg_.wheels[i].pins.encoder_b >= 0 ? vel[i] : drive_signs_[i] * vel[i];
+    if (cfg_.closed_loop && use_table)
+    {
+      duties[i] = std::lround(pids_[i].compute_with_feedforward(
+        duty_tables_[i].lookup(cmd[i]), cmd[i], measured, delta_seconds) * duty_scale);
+    }
+    else if (cfg_.closed_loop)
+    {
+      duties[i] = std::lround(pids_[i].compute(cmd[i], measured, delta_seconds) * duty_scale);
+    }
+    else if (use_table)
+    {
+      duties[i] = std::lround(duty_tables_[i].lookup(cmd[i]) * duty_scale);
+    }
+    else
+    {
+      duties[i] = cmd[i] * 10 * duty_scale;
+    }
+    if (duties[i] != 0)
+    {
+      drive_signs_[i] = duties[i] > 0 ? 1 : -1;
+    }
+  }
+
+  send_motor_values(duties);
+}
+
+void DiffBotSystemHardware::send_motor_values(const int * duties)
+{
+  if (gpio_controller_.io_thread_running())
+  {
+    gpio_controller_.post_motor_values(duties);
+  }
+  else
+  {
+    gpio_controller_.apply_motor_values(duties);
+  }
+}
+
+void DiffBotSystemHardware::drive_all_motors(int duty)
+{
+  int duties[Controller::MAX_MOTORS];
+  std::fill(duties, duties + Controller::MAX_MOTORS, duty);
+  send_motor_values(duties);
+}
+
+bool DiffBotSystemHardware::load_wheel_duty_tables()
+{
+  std::vector<std::pair<std::string, DutyVelocityTable *>> tables;
+  for (size_t i = 0; i < wheels_.size(); i++)
+  {
+    tables.emplace_back(wheels_.names[i], &duty_tables_[i]);
+  }
+  return load_duty_tables(cfg_.duty_table_file, tables);
+}
+
+void DiffBotSystemHardware::update_diagnostics()
+{
+  const LatencyHistogram * histograms[kDiagnosticMetrics] = {
+    &read_period_hist_, &write_duration_hist_, &gpio_controller_.backend_latency,
+    &gpio_controller_.callback_latency};
+
+  for (size_t metric = 0; metric < kDiagnosticMetrics; metric++)
+  {
+    double quantiles_ns[kDiagnosticStats - 1];
+    histograms[metric]->quantiles(kDiagnosticQuantiles, quantiles_ns, kDiagnosticStats - 1);
+    for (size_t stat = 0; stat + 1 < kDiagnosticStats; stat++)
+    {
+      diagnostics_[metric][stat] = quantiles_ns[stat] / 1000.0;
+    }
+    diagnostics_[metric][kDiagnosticStats - 1] = histograms[metric]->max_ns() / 1000.0;
+  }
+}
+
+// The startup checks of write_deadline_ms and breakaway_time_ms go by
+// update_rate, a copy of the controller_manager's rate. Warns once when the
+// measured period says that copy is off, or that the deadline cannot hold.
+void DiffBotSystemHardware::check_write_period(double period_ms) const
+{
+  const double configured_ms = cfg_.update_rate > 0 ? 1000.0 / cfg_.update_rate : 0;
+  if (std::fabs(period_ms - configured_ms) > 0.2 * configured_ms)
+  {
+    RCLCPP_WARN(
+      rclcpp::get_logger("DiffBotSystemHardware"),
+      "write() comes every %.1f ms, but update_rate %.1f Hz means %.1f ms; set update_rate to the "
+      "controller_manager update_rate.", period_ms, cfg_.update_rate, configured_ms);
+  }
+  // on_init already warned when update_rate gave the same result.
+  if (
+    cfg_.write_deadline_ms > 0 && cfg_.write_deadline_ms < 2 * period_ms &&
+    cfg_.write_deadline_ms >= 2 * configured_ms)
+  {
+    RCLCPP_WARN(
+      rclcpp::get_logger("DiffBotSystemHardware"),
+      "write_deadline_ms %.0f is less than twice the measured %.1f ms write period; late cycles will brake.",
+      cfg_.write_deadline_ms, period_ms);
+  }
+}
+
+// Runs on the watchdog thread. The brake goes straight to the backend, past
+// the I/O thread, which may be stuck behind the same stall. Without the I/O
+// thread the stall can be write()'s own backend call, which zeroes the
+// motors again when it returns.
+void DiffBotSystemHardware::brake_on_missed_write(void * self)
+{
+  DiffBotSystemHardware * hardware = static_cast<DiffBotSystemHardware *>(self);
+  hardware->gpio_controller_.brake();
+  RCLCPP_WARN(
+    rclcpp::get_logger("DiffBotSystemHardware"),
+    "write() missed its %.0f ms deadline; motors braked (%lu misses so far).",
+    hardware->cfg_.write_deadline_ms, static_cast<unsigned long>(hardware->write_watchdog_.misses()));
+}
+
+void DiffBotSystemHardware::setup_sim_motors(SimMotorBackend & plant)
+{
+  plant.time_scale = cfg_.sim_time_scale;
+
+  // enc_counts_per_rev counts both edges of channel A, i.e. two per cycle.
+  for (const WheelConfig & wheel : cfg_.wheels)
+  {
+    SimMotor motor;
+    motor.cycles_per_rev = wheel.enc_counts_per_rev / 2.0;
+    motor.gain = cfg_.sim_motor_gain;
+    motor.time_constant = cfg_.sim_motor_time_constant;
+    motor.deadband = cfg_.sim_motor_deadband;
+    motor.pwm_pin = wheel.pins.pwm;
+    motor.direction_pin = wheel.pins.direction;
+    motor.a_pin = wheel.pins.encoder_a;
+    motor.b_pin = wheel.pins.encoder_b;
+    motor.reverse_level = wheel.pins.reverse_level;
+    plant.add_motor(motor);
+  }
+}
+
+void DiffBotSystemHardware::start_inner_loop()
+{
+  if (inner_loop_running_)
+  {
+    return;
+  }
+
+  RCLCPP_INFO(
+    rclcpp::get_logger("DiffBotSystemHardware"), "Starting inner control loop at %.0f Hz.",
+    cfg_.inner_loop_rate);
+  inner_loop_running_ = true;
+  inner_loop_thread_ = std::thread(&DiffBotSystemHardware::inner_loop, this);
+}
+
+void DiffBotSystemHardware::stop_inner_loop()
+{
+  inner_loop_running_ = false;
+  if (inner_loop_thread_.joinable())
+  {
+    inner_loop_thread_.join();
+  }
+}
+
+void DiffBotSystemHardware::inner_loop()
+{
+  cfg_.realtime.apply_to_current_thread("diffbot-inner");
+
+  const auto loop_period = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+    std::chrono::duration<double>(1.0 / cfg_.inner_loop_rate));
+  auto previous = std::chrono::steady_clock::now();
+  auto next_cycle = previous + loop_period;
+
+  const size_t count = wheels_.size();
+  WheelCommands commands;
+  WheelStates states;
+  for (size_t i = 0; i < count; i++)
+  {
+    commands.cmd[i] = wheels_.cmd[i];
+    states.pos[i] = wheels_.calc_enc_angle(i);
+  }
+
+  while (inner_loop_running_)
+  {
+    std::this_thread::sleep_until(next_cycle);
+    next_cycle += loop_period;
+
+    // After an overrun, restart the schedule instead of running back to back.
+    auto now = std::chrono::steady_clock::now();
+    if (now > next_cycle)
+    {
+      next_cycle = now + loop_period;
+    }
+    double delta_seconds = std::chrono::duration<double>(now - previous).count();
+    previous = now;
+
+    const bool from_counter = experiment_running_;
+    for (size_t i = 0; i < count; i++)
+    {
+      const double pos_prev = states.pos[i];
+      states.pos[i] = wheels_.calc_enc_angle(i);
+      states.vel[i] = from_counter ?
+        wheels_.counter_velocity(i, states.pos[i], pos_prev, delta_seconds) :
+        wheels_.sample_velocity(i, states.pos[i], pos_prev, delta_seconds, cfg_.edge_velocity);
+    }
+
+    if (odometry_enabled())
+    {
+      odometry_.integrate(wheels_.tracks.data());
+      states.x = odometry_.x;
+      states.y = odometry_.y;
+      states.theta = odometry_.theta;
+    }
+
+    command_slot_.take(commands);
+    command_motors(commands.cmd, states.vel, delta_seconds);
+
+    state_slot_.publish(states);
+  }
+}
+
+void DiffBotSystemHardware::start_experiments()
+{
+  if (experiment_running_)
+  {
+    return;
+  }
+
+  experiment_running_ = true;
+  experiment_thread_ = std::thread(&DiffBotSystemHardware::run_experiments, this);
+}
+
+void DiffBotSystemHardware::stop_experiments()
+{
+  experiment_running_ = false;
+  if (experiment_thread_.joinable())
+  {
+    experiment_thread_.join();
+  }
+}
+
+// Sleeps in short slices so a deactivate does not wait for a whole step.
+bool DiffBotSystemHardware::experiment_wait(double seconds)
+{
+  const auto end = std::chrono::steady_clock::now() + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+    std::chrono::duration<double>(seconds));
+  while (experiment_running_ && std::chrono::steady_clock::now() < end)
+  {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  return experiment_running_;
+}
+
+void DiffBotSystemHardware::run_experiments()
+{
+  // Same settings as the inner loop: system identification samples every
+  // kSystemIdPeriod and fits a dead time to that timing.
+  cfg_.realtime.apply_to_current_thread("diffbot-exp");
+
+  if (cfg_.duty_calibration)
+  {
+    calibrate_duty_tables();
+  }
+  if (cfg_.system_identification && experiment_running_)
+  {
+    identify_motors();
+  }
+
+  drive_all_motors(0);
+  experiment_running_ = false;
+}
+
+// Steps all wheels through calibration_steps duties up to the duty clamp,
+// forwards and then backwards, and records the settled speed of each step.
+// Encoder angles are read from the counters, so the sweep works with or
+// without the inner loop and with single-channel encoders (which only count
+// up, hence the speed magnitudes).
+void DiffBotSystemHardware::calibrate_duty_tables()
+{
+  RCLCPP_INFO(
+    rclcpp::get_logger("DiffBotSystemHardware"),
+    "Starting duty calibration sweep: %u steps per direction, about %.0f s. Keep the wheels off the ground.",
+    cfg_.calibration_steps,
+    2 * (cfg_.calibration_steps * (cfg_.calibration_settle_time + cfg_.calibration_measure_time) +
+    cfg_.calibration_settle_time));
+
+  const double duty_scale =
+    static_cast<double>(gpio_controller_.pwm_range) / Controller::DEFAULT_PWM_RANGE;
+  const size_t count = wheels_.size();
+  std::vector<DutyVelocityTable> tables(count);
+  std::vector<double> start(count);
+  bool complete = true;
+
+  for (size_t direction : {DutyVelocityTable::FORWARD, DutyVelocityTable::REVERSE})
+  {
+    const double sign = direction == DutyVelocityTable::FORWARD ? 1.0 : -1.0;
+    for (unsigned step = 1; step <= cfg_.calibration_steps && complete; step++)
+    {
+      const double duty = static_cast<double>(Controller::DEFAULT_MAX_DUTY) * step / cfg_.calibration_steps;
+      const int pin_duty = static_cast<int>(std::lround(sign * duty * duty_scale));
+      drive_all_motors(pin_duty);
+
+      complete = experiment_wait(cfg_.calibration_settle_time);
+      for (size_t i = 0; i < count; i++)
+      {
+        start[i] = wheels_.calc_enc_angle(i);
+      }
+      complete = complete && experiment_wait(cfg_.calibration_measure_time);
+
+      for (size_t i = 0; i < count; i++)
+      {
+        tables[i].add_point(
+          direction, duty, (wheels_.calc_enc_angle(i) - start[i]) / cfg_.calibration_measure_time);
+      }
+    }
+
+    drive_all_motors(0);
+    complete = complete && experiment_wait(cfg_.calibration_settle_time);
+  }
+
+  drive_all_motors(0);
+
+  if (!complete)
+  {
+    RCLCPP_WARN(rclcpp::get_logger("DiffBotSystemHardware"), "Duty calibration sweep aborted.");
+    return;
+  }
+
+  bool fitted = true;
+  std::vector<std::pair<std::string, const DutyVelocityTable *>> named_tables;
+  for (size_t i = 0; i < count; i++)
+  {
+    fitted = tables[i].fit() && fitted;
+    named_tables.emplace_back(wheels_.names[i], &tables[i]);
+  }
+
+  if (!fitted)
+  {
+    RCLCPP_ERROR(
+      rclcpp::get_logger("DiffBotSystemHardware"),
+      "Duty calibration found no usable speed range; check the encoders and motor wiring.");
+  }
+  else if (!save_duty_tables(cfg_.duty_table_file, named_tables))
+  {
+    RCLCPP_ERROR(
+      rclcpp::get_logger("DiffBotSystemHardware"), "Could not write duty table '%s'.",
+      cfg_.duty_table_file.c_str());
+  }
+  else
+  {
+    RCLCPP_INFO(
+      rclcpp::get_logger("DiffBotSystemHardware"), "Duty calibration written to '%s'.",
+      cfg_.duty_table_file.c_str());
+    if (cfg_.duty_table)
+    {
+      load_wheel_duty_tables();
+    }
+  }
+}
+
+// Drives all wheels from standstill with a step to half the duty clamp, a
+// step to 90 % of it and a logarithmic chirp around 70 % from 0.2 to 10 Hz.
+// The speed is sampled every kSystemIdPeriod from the edge timestamps (T
+// method only, so it does not quantise) and the fit starts at the second
+// step, past breakaway and static friction. Forward only, so it works with
+// single-channel encoders too.
+void DiffBotSystemHardware::identify_motors()
+{
+  const double max_duty = Controller::DEFAULT_MAX_DUTY;
+  const double rest_time = 0.5;
+  const double step_time = 1.5;
+  const double chirp_time = 6.0;
+  const double chirp_low = 0.2;
+  const double chirp_high = 10.0;
+  const double chirp_start = rest_time + 2 * step_time;
+  const size_t samples = static_cast<size_t>((chirp_start + chirp_time + rest_time) / kSystemIdPeriod);
+  const size_t fit_start = static_cast<size_t>((rest_time + step_time) / kSystemIdPeriod);
+  const size_t max_delay = static_cast<size_t>(0.1 / kSystemIdPeriod);
+
+  RCLCPP_INFO(
+    rclcpp::get_logger("DiffBotSystemHardware"),
+    "Starting system identification: steps and a chirp on all wheels, about %.0f s. "
+    "Keep the wheels off the ground.", samples * kSystemIdPeriod);
+
+  const double duty_scale =
+    static_cast<double>(gpio_controller_.pwm_range) / Controller::DEFAULT_PWM_RANGE;
+  const size_t count = wheels_.size();
+  std::vector<VelocityEstimator> estimators(count);
+  for (size_t i = 0; i < count; i++)
+  {
+    estimators[i].setup(wheels_.rads_per_count[i], std::numeric_limits<unsigned>::max(), cfg_.velocity_timeout);
+    wheels_.edges[i].clear();
+  }
+
+  // speed[i][k + 1] is measured at the end of the sample that applies duty[k].
+  std::vector<double> duty(samples);
+  std::vector<std::vector<double>> speed(count, std::vector<double>(samples + 1));
+
+  const double chirp_rate = std::log(chirp_high / chirp_low) / chirp_time;
+  const auto sample_period = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+    std::chrono::duration<double>(kSystemIdPeriod));
+  auto previous = std::chrono::steady_clock::now();
+  auto next_sample = previous;
+
+  for (size_t k = 0; k < samples; k++)
+  {
+    const double t = k * kSystemIdPeriod;
+    if (t >= chirp_start + chirp_time)
+    {
+      duty[k] = 0;
+    }
+    else if (t >= chirp_start)
+    {
+      const double phase = 2 * M_PI * chirp_low * (std::exp(chirp_rate * (t - chirp_start)) - 1) / chirp_rate;
+      duty[k] = max_duty * (0.7 + 0.2 * std::sin(phase));
+    }
+    else if (t >= rest_time + step_time)
+    {
+      duty[k] = 0.9 * max_duty;
+    }
+    else if (t >= rest_time)
+    {
+      duty[k] = 0.5 * max_duty;
+    }
+
+    drive_all_motors(static_cast<int>(std::lround(duty[k] * duty_scale)));
+
+    next_sample += sample_period;
+    std::this_thread::sleep_until(next_sample);
+    if (!experiment_running_)
+    {
+      RCLCPP_WARN(rclcpp::get_logger("DiffBotSystemHardware"), "System identification aborted.");
+      return;
+    }
+
+    auto now = std::chrono::steady_clock::now();
+    const double delta_seconds = std::chrono::duration<double>(now - previous).count();
+    previous = now;
+    for (size_t i = 0; i < count; i++)
+    {
+      speed[i][k + 1] = std::fabs(estimators[i].update(wheels_.edges[i], delta_seconds));
+    }
+  }
+
+  drive_all_motors(0);
+
+  std::vector<FopdtModel> models(count);
+  std::vector<std::pair<std::string, const FopdtModel *>> named_models;
+  for (size_t i = 0; i < count; i++)
+  {
+    if (!models[i].fit(duty, speed[i], kSystemIdPeriod, fit_start, max_delay))
+    {
+      RCLCPP_ERROR(
+        rclcpp::get_logger("DiffBotSystemHardware"),
+        "System identification found no first-order response for %s; check the encoders and motor wiring.",
+        wheels_.names[i].c_str());
+      return;
+    }
+    RCLCPP_INFO(
+      rclcpp::get_logger("DiffBotSystemHardware"),
+      "%s: gain %.4f rad/s per duty step, time constant %.1f ms, dead time %.1f ms, "
+      "deadband duty %.1f, rms error %.3f rad/s.",
+      wheels_.names[i].c_str(), models[i].gain, models[i].time_constant * 1000,
+      models[i].dead_time * 1000, models[i].deadband_duty, models[i].rms_error);
+    named_models.emplace_back(wheels_.names[i], &models[i]);
+  }
+
+  if (!save_fopdt_models(cfg_.system_id_file, named_models))
+  {
+    RCLCPP_ERROR(
+      rclcpp::get_logger("DiffBotSystemHardware"), "Could not write system identification '%s'.",
+      cfg_.system_id_file.c_str());
+  }
+  else
+  {
+    RCLCPP_INFO(
+      rclcpp::get_logger("DiffBotSystemHardware"), "System identification written to '%s'.",
+      cfg_.system_id_file.c_str());
+  }
+
+  // command_motors leaves the PIDs alone while the experiment runs, so the
+  // gains can be swapped from here.
+  if (cfg_.closed_loop)
+  {
+    double kp;
+    double ki;
+    double kff;
+    double friction;
+    for (size_t i = 0; i < count; i++)
+    {
+      models[i].suggest_pid(kp, ki, kff, friction);
+      pids_[i].setup(kp, ki, 0, kff, friction, cfg_.pid_i_clamp, cfg_.pid_output_limit);
+    }
+    RCLCPP_INFO(
+      rclcpp::get_logger("DiffBotSystemHardware"), "Wheel PIDs retuned from the identified models.");
+  }
+}
+
 }  // namespace diffdrive_mini_ocebot
 
 #include "pluginlib/class_list_macros.hpp"
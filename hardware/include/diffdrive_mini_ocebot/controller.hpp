@@ -1,99 +1,568 @@
 #ifndef DIFFDRIVE_MINI_OCEBOT_CONTROLLER_HPP
 #define DIFFDRIVE_MINI_OCEBOT_CONTROLLER_HPP
 
-#include <pigpiod_if2.h>
+#include <algorithm>
+#include <atomic>
 #include <cmath>
 #include <chrono>
+#include <cstdint>
+#include <memory>
 #include <thread>
+#include <vector>
 
 #include "rclcpp/rclcpp.hpp"
+#include "diffdrive_mini_ocebot/event_log.hpp"
+#include "diffdrive_mini_ocebot/gpio_backend.hpp"
+#include "diffdrive_mini_ocebot/latency_histogram.hpp"
+#include "diffdrive_mini_ocebot/latest_value_slot.hpp"
+#include "diffdrive_mini_ocebot/quadrature_encoder.hpp"
+#include "diffdrive_mini_ocebot/realtime.hpp"
+
+// Last value sent to an output pin, so repeated commands can skip the backend.
+struct ShadowRegister
+{
+    int value = -1;
+
+    bool changed(int new_value) const
+    {
+        return value != new_value;
+    }
+
+    void invalidate()
+    {
+        value = -1;
+    }
+};
+
+// Breakaway state of one motor: the sign of its last command and, while a
+// kick is running, when it ends.
+struct BreakawayKick
+{
+    int sign = 0;
+    int64_t until_ns = 0;
+};
+
+// Pins of one wheel. encoder_b is -1 for a single-channel encoder.
+struct MotorPins
+{
+    int pwm = 0;
+    int direction = 0;
+    // Direction pin level that drives the wheel backwards. A stopped motor
+    // leaves the pin low.
+    int reverse_level = 1;
+    int encoder_a = 0;
+    int encoder_b = -1;
+};
+
+// Output side of one motor: its pins, the last levels sent to them and the
+// breakaway state.
+struct MotorChannel
+{
+    MotorPins pins;
+    ShadowRegister direction_shadow;
+    ShadowRegister pwm_shadow;
+    BreakawayKick kick;
+    // Backend callback ids of the encoder pins (A, B), -1 while not
+    // registered.
+    int encoder_callbacks[2] = {-1, -1};
+};
+
+// Signed duty of every motor. Fixed size so it fits a latest-value slot.
+struct MotorCommand
+{
+    static constexpr size_t MAX_MOTORS = 8;
+
+    int duty[MAX_MOTORS] = {};
+    int64_t stamp_ns = 0;
+};
+
+// Command-to-pin latency of the asynchronous I/O path. Written by the I/O
+// thread, safe to read from any thread.
+struct LatencyStats
+{
+    std::atomic<uint64_t> count{0};
+    std::atomic<uint64_t> total_ns{0};
+    std::atomic<uint64_t> max_ns{0};
+
+    void add(uint64_t latency_ns)
+    {
+        count.fetch_add(1, std::memory_order_relaxed);
+        total_ns.fetch_add(latency_ns, std::memory_order_relaxed);
+        if (latency_ns > max_ns.load(std::memory_order_relaxed))
+        {
+            max_ns.store(latency_ns, std::memory_order_relaxed);
+        }
+    }
+
+    void reset()
+    {
+        count = 0;
+        total_ns = 0;
+        max_ns = 0;
+    }
+
+    double mean_ns() const
+    {
+        uint64_t n = count.load(std::memory_order_relaxed);
+        return n == 0 ? 0.0 : static_cast<double>(total_ns.load(std::memory_order_relaxed)) / n;
+    }
+};
 
 class Controller
 {
     public:
-    int pi = 0;
-    int left_enc = 0;
-    int right_enc = 0;
-    int left_motor = 0;
-    int right_motor = 0;
-    int left_direction = 0;
-    int right_direction = 0;
+    static constexpr size_t MAX_MOTORS = MotorCommand::MAX_MOTORS;
+
+    std::unique_ptr<GpioBackend> gpio;
+    std::vector<MotorChannel> motors;
+    uint64_t skipped_calls = 0;
+
+    // Motor duty range and the duty set_motor_values clamps to.
+    static constexpr int DEFAULT_PWM_RANGE = 255;
+    static constexpr int DEFAULT_MAX_DUTY = 115;
+    int pwm_range = DEFAULT_PWM_RANGE;
+    int max_duty = DEFAULT_MAX_DUTY;
+
+    // Static friction: a command that leaves zero or reverses runs at least
+    // kick_duty for kick_duration_ns, and any non-zero command at least
+    // min_duty (dead-band compensation). Both in pin duty units, 0 = off.
+    // The kick ends on the first set_motor_values after the deadline; the
+    // I/O thread re-applies the command every poll while a kick runs.
+    int kick_duty = 0;
+    int64_t kick_duration_ns = 0;
+    int min_duty = 0;
+
+    // One per motor, fixed in place once setup() made them since the
+    // callbacks point at them.
+    std::vector<QuadratureEncoder> decoders;
+
+    LatencyStats io_latency;
+
+    // Duration of every backend call and encoder callback, recorded only
+    // when record_latency is set before setup().
+    bool record_latency = false;
+    LatencyHistogram backend_latency;
+    LatencyHistogram callback_latency;
+
+    // When set before register_encoders(), every encoder edge, initial input
+    // level and pin change is appended here for later replay.
+    EventLog *event_log = nullptr;
+
+    // Applied to the I/O thread. The backend applies its own copy to the
+    // threads it delivers encoder callbacks on.
+    RealtimeConfig realtime;
 
     Controller() = default;
 
-    Controller(int left_enc_pin, int right_enc_pin, int left_motor_pin, int right_motor_pin, int left_dir_pin, int right_dir_pin)
+    ~Controller()
     {
-        setup(left_enc_pin, right_enc_pin, left_motor_pin, right_motor_pin, left_dir_pin, right_dir_pin);    
+        stop_io_thread();
     }
 
-    void setup(int left_enc_pin, int right_enc_pin, int left_motor_pin, int right_motor_pin, int left_dir_pin, int right_dir_pin)
+    Controller(std::unique_ptr<GpioBackend> backend, const std::vector<MotorPins> &pins)
     {
-        pi = pigpio_start(NULL, NULL);
+        setup(std::move(backend), pins);
+    }
+
+    // One motor per entry, at most MAX_MOTORS. Wheels with a B encoder pin
+    // are decoded in 4x quadrature and count in both directions.
+    bool setup(std::unique_ptr<GpioBackend> backend, const std::vector<MotorPins> &pins)
+    {
+        gpio = std::move(backend);
+        if (!gpio || pins.size() > MAX_MOTORS || !gpio->connect())
+        {
+            return false;
+        }
+
+        motors.assign(pins.size(), MotorChannel());
+        decoders = std::vector<QuadratureEncoder>(pins.size());
+        for (size_t i = 0; i < pins.size(); i++)
+        {
+            motors[i].pins = pins[i];
+        }
 
-        left_enc = left_enc_pin;
-        right_enc = right_enc_pin;
+        for (const MotorChannel &motor : motors)
+        {
+            gpio->set_mode(motor.pins.encoder_a, GpioBackend::INPUT);
+            if (motor.pins.encoder_b >= 0)
+            {
+                gpio->set_mode(motor.pins.encoder_b, GpioBackend::INPUT);
+            }
+        }
+
+        for (MotorChannel &motor : motors)
+        {
+            gpio->set_mode(motor.pins.pwm, GpioBackend::OUTPUT);
+            gpio->set_pwm_dutycycle(motor.pins.pwm, 0);
+            gpio->set_mode(motor.pins.direction, GpioBackend::OUTPUT);
+            motor.pwm_shadow.value = 0;
+        }
+        skipped_calls = 0;
+
+        return true;
+    }
 
-        left_motor = left_motor_pin;
-        right_motor = right_motor_pin;
+    size_t motor_count() const
+    {
+        return motors.size();
+    }
 
-	left_direction = left_dir_pin;
-	right_direction = right_dir_pin;
+    // Switches every motor pin to the given duty range and PWM frequency
+    // (0 = backend default), on the PWM peripheral when hardware is set and
+    // the pin has a channel. max_duty keeps the same fraction of full power.
+    // Returns the number of motor pins on hardware PWM, or -1 on error.
+    int configure_pwm(unsigned frequency, unsigned range, bool hardware)
+    {
+        int hardware_pins = 0;
+        for (const MotorChannel &motor : motors)
+        {
+            int mode = gpio->configure_pwm(motor.pins.pwm, frequency, range, hardware);
+            if (mode < 0)
+            {
+                return -1;
+            }
+            hardware_pins += mode;
+        }
 
-        set_mode(pi, left_enc, PI_INPUT);
-        set_mode(pi, right_enc, PI_INPUT);
-        
-	set_mode(pi, left_motor, PI_OUTPUT);
-        set_mode(pi, right_motor, PI_OUTPUT);
+        pwm_range = static_cast<int>(range);
+        max_duty = static_cast<int>(std::lround(static_cast<double>(DEFAULT_MAX_DUTY) * range / DEFAULT_PWM_RANGE));
 
-	set_PWM_dutycycle(pi, left_motor, 0);
-	set_PWM_dutycycle(pi, right_motor, 0);
+        for (MotorChannel &motor : motors)
+        {
+            gpio->set_pwm_dutycycle(motor.pins.pwm, 0);
+            motor.pwm_shadow.value = 0;
+        }
 
-	set_mode(pi, left_direction, PI_OUTPUT);
-	set_mode(pi, right_direction, PI_OUTPUT);
+        return hardware_pins;
     }
 
-    void register_encoders(int &left_enc, int &right_enc)
+    // Counters and edge rings are indexed like the motors. Returns false if
+    // the backend refused a callback; the others stay registered until
+    // cancel_encoders().
+    bool register_encoders(EncoderCounter *counters, EncoderEdgeRing *edges)
     {
-	callback_ex(pi, this->left_enc, EITHER_EDGE, read_enc_value, &left_enc);
-	callback_ex(pi, this->right_enc, EITHER_EDGE, read_enc_value, &right_enc);
+        gpio->begin_edge_changes();
+        bool registered = true;
+        for (size_t i = 0; i < motors.size(); i++)
+        {
+            registered = register_encoder(motors[i], decoders[i], counters[i], edges[i]) && registered;
+        }
+        return gpio->end_edge_changes() >= 0 && registered;
     }
 
-    static void read_enc_value(int /* pi */, unsigned /*gpio*/, unsigned /*level*/, uint32_t /*tick*/, void *encoder)
+    // Stops edge delivery without touching the backend connection, so the
+    // encoders can be registered again later.
+    void cancel_encoders()
     {
-	(*((int*) encoder))++;
+        gpio->begin_edge_changes();
+        for (MotorChannel &motor : motors)
+        {
+            for (int &id : motor.encoder_callbacks)
+            {
+                if (id >= 0)
+                {
+                    gpio->cancel_edge_callback(id);
+                    id = -1;
+                }
+            }
+        }
+        gpio->end_edge_changes();
     }
 
-    void set_motor_values(int left, int right)
+    bool register_encoder(MotorChannel &motor, QuadratureEncoder &decoder, EncoderCounter &encoder, EncoderEdgeRing &edges)
     {
-        int left_direction = (left < 0) ? 1 : 0;
-        int right_direction = (right > 0) ? 1 : 0;
+        const int a_pin = motor.pins.encoder_a;
+        const int b_pin = motor.pins.encoder_b;
+        int *callback_ids = motor.encoder_callbacks;
 
-        int left_PWM = std::min(abs(left), 115); //Limit to about 45% max power
-        int right_PWM = std::min(abs(right), 115);
+        decoder.callback_latency = record_latency ? &callback_latency : nullptr;
+        decoder.event_log = event_log;
 
-        gpio_write(pi, this->left_direction, left_direction);
-        gpio_write(pi, this->right_direction, right_direction);
-	
-	int left_current_PWM = get_PWM_dutycycle(pi, left_motor);
-	int right_current_PWM = get_PWM_dutycycle(pi, right_motor);
+        if (b_pin < 0)
+        {
+            decoder.setup(a_pin, b_pin, encoder, edges, 0, 0);
+            callback_ids[0] = gpio->add_edge_callback(a_pin, read_enc_value, &decoder);
+            return callback_ids[0] >= 0;
+        }
 
-//	if(((left_PWM < left_current_PWM) && (left_PWM < (0.2 * 255))) && ((right_PWM < right_current_PWM) && (right_PWM < (0.2 * 255))))
-//	{
-//	    set_PWM_dutycycle(pi, right_motor, 0.2 * 255);
-//	    set_PWM_dutycycle(pi, left_motor, 0.2 * 255);
-//
-//	    std::this_thread::sleep_for(std::chrono::milliseconds(5));
-//	}
+        int a_level = gpio->read(a_pin);
+        int b_level = gpio->read(b_pin);
+        if (event_log != nullptr)
+        {
+            event_log->append(EventRecord::INPUT_LEVEL, a_pin, a_level);
+            event_log->append(EventRecord::INPUT_LEVEL, b_pin, b_level);
+        }
+        decoder.setup(a_pin, b_pin, encoder, edges, a_level, b_level);
+        callback_ids[0] = gpio->add_edge_callback(a_pin, read_enc_value, &decoder);
+        callback_ids[1] = gpio->add_edge_callback(b_pin, read_enc_value, &decoder);
+        return callback_ids[0] >= 0 && callback_ids[1] >= 0;
+    }
 
-	set_PWM_dutycycle(pi, right_motor, right_PWM);
-//	set_PWM_dutycycle(pi, right_motor, 255);
-//	set_PWM_dutycycle(pi, left_motor, 255);
-	set_PWM_dutycycle(pi, left_motor, left_PWM);
+    static void read_enc_value(unsigned gpio, unsigned level, uint32_t tick, void *decoder)
+    {
+        QuadratureEncoder *quadrature = static_cast<QuadratureEncoder *>(decoder);
+
+        ScopedLatency timing(quadrature->callback_latency);
+        if (quadrature->event_log != nullptr)
+        {
+            quadrature->event_log->append(EventRecord::EDGE, gpio, level, tick);
+        }
+        quadrature->update(gpio, level, tick);
+    }
+
+    unsigned encoder_errors() const
+    {
+        unsigned errors = 0;
+        for (const QuadratureEncoder &decoder : decoders)
+        {
+            errors += decoder.errors.load(std::memory_order_relaxed);
+        }
+        return errors;
+    }
+
+    // One signed duty per motor.
+    void set_motor_values(const int *duties)
+    {
+        if (shadows_stale.load(std::memory_order_relaxed) && shadows_stale.exchange(false, std::memory_order_acquire))
+        {
+            for (MotorChannel &motor : motors)
+            {
+                motor.direction_shadow.invalidate();
+                motor.pwm_shadow.invalidate();
+            }
+        }
+
+        const bool compensate = kick_duty > 0 || min_duty > 0;
+        const int64_t now = compensate ? now_ns() : 0;
+        for (size_t i = 0; i < motors.size(); i++)
+        {
+            MotorChannel &motor = motors[i];
+            const int duty = duties[i];
+            const int direction = duty < 0 ? motor.pins.reverse_level : (duty > 0 ? 1 - motor.pins.reverse_level : 0);
+
+            int pwm = std::min(abs(duty), max_duty); //Limit to about 45% max power
+            if (compensate)
+            {
+                pwm = std::min(compensate_friction(motor.kick, duty, pwm, now), max_duty);
+            }
+
+            write_if_changed(motor.pins.direction, motor.direction_shadow, direction);
+            set_pwm_if_changed(motor.pins.pwm, motor.pwm_shadow, pwm);
+        }
+    }
+
+    bool kick_running() const
+    {
+        for (const MotorChannel &motor : motors)
+        {
+            if (motor.kick.until_ns != 0)
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    int compensate_friction(BreakawayKick &kick, int command, int pwm, int64_t now)
+    {
+        int sign = (command > 0) - (command < 0);
+        if (sign != 0 && sign != kick.sign && kick_duty > 0)
+        {
+            kick.until_ns = now + kick_duration_ns;
+        }
+        kick.sign = sign;
+
+        if (sign == 0 || now >= kick.until_ns)
+        {
+            kick.until_ns = 0;
+        }
+
+        if (sign == 0)
+        {
+            return pwm;
+        }
+        return std::max(pwm, kick.until_ns != 0 ? std::max(kick_duty, min_duty) : min_duty);
+    }
+
+    // A failed call leaves the pin state unknown, so the shadow is dropped and
+    // the next command goes through.
+    void write_if_changed(int pin, ShadowRegister &shadow, int level)
+    {
+        if (!shadow.changed(level))
+        {
+            skipped_calls++;
+            return;
+        }
+
+        shadow.value = level;
+        if (event_log != nullptr)
+        {
+            event_log->append(EventRecord::WRITE, pin, level);
+        }
+        ScopedLatency timing(record_latency ? &backend_latency : nullptr);
+        if (gpio->write(pin, level) < 0)
+        {
+            shadow.invalidate();
+        }
+    }
+
+    void set_pwm_if_changed(int pin, ShadowRegister &shadow, int duty)
+    {
+        if (!shadow.changed(duty))
+        {
+            skipped_calls++;
+            return;
+        }
+
+        shadow.value = duty;
+        if (event_log != nullptr)
+        {
+            event_log->append(EventRecord::PWM, pin, duty);
+        }
+        ScopedLatency timing(record_latency ? &backend_latency : nullptr);
+        if (gpio->set_pwm_dutycycle(pin, duty) < 0)
+        {
+            shadow.invalidate();
+        }
+    }
+
+    // Zeroes every motor pin straight through the backend, from any thread,
+    // without waiting for the I/O thread. The shadows of the commanding
+    // thread are not touched here; its next set_motor_values resends all pins.
+    // The I/O thread drops the command it holds and any running kick, so it
+    // cannot drive the motors again before a new command is posted.
+    void brake()
+    {
+        braked.store(true, std::memory_order_release);
+        for (const MotorChannel &motor : motors)
+        {
+            if (event_log != nullptr)
+            {
+                event_log->append(EventRecord::PWM, motor.pins.pwm, 0);
+            }
+            gpio->set_pwm_dutycycle(motor.pins.pwm, 0);
+        }
+        shadows_stale.store(true, std::memory_order_release);
+    }
+
+    // Moves the backend calls of set_motor_values onto a dedicated thread.
+    // post_motor_values then only publishes into a latest-value slot, which
+    // the thread drains every poll_period.
+    void start_io_thread(std::chrono::microseconds poll_period)
+    {
+        if (io_running)
+        {
+            return;
+        }
+
+        io_latency.reset();
+        io_running = true;
+        io_thread = std::thread(&Controller::io_loop, this, poll_period);
+    }
+
+    void stop_io_thread()
+    {
+        io_running = false;
+        if (io_thread.joinable())
+        {
+            io_thread.join();
+        }
+    }
+
+    bool io_thread_running() const
+    {
+        return io_running;
+    }
+
+    // set_motor_values for the commanding thread when there is no I/O
+    // thread. A brake() that lands while these backend calls block would be
+    // overwritten by the remaining writes, so the motors are zeroed again
+    // once they return.
+    void apply_motor_values(const int *duties)
+    {
+        braked.store(false, std::memory_order_relaxed);
+        set_motor_values(duties);
+        if (braked.exchange(false, std::memory_order_acquire))
+        {
+            const MotorCommand stop;
+            set_motor_values(stop.duty);
+        }
+    }
+
+    // Wait-free, never touches the backend. Only valid while the I/O thread runs.
+    void post_motor_values(const int *duties)
+    {
+        MotorCommand command;
+        std::copy(duties, duties + motors.size(), command.duty);
+        command.stamp_ns = now_ns();
+        motor_mailbox.publish(command);
     }
 
     void cleanup()
     {
-        pigpio_stop(pi);
+        stop_io_thread();
+        if (gpio)
+        {
+            cancel_encoders();
+            gpio->disconnect();
+        }
+    }
+
+    private:
+    LatestValueSlot<MotorCommand> motor_mailbox;
+    std::atomic<bool> io_running{false};
+    std::thread io_thread;
+    std::atomic<bool> shadows_stale{false};
+    std::atomic<bool> braked{false};
+
+    static int64_t now_ns()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    void io_loop(std::chrono::microseconds poll_period)
+    {
+        realtime.apply_to_current_thread("diffbot-io");
+
+        MotorCommand command;
+        auto next_poll = std::chrono::steady_clock::now();
+
+        braked.store(false, std::memory_order_relaxed);
+
+        while (io_running)
+        {
+            if (braked.exchange(false, std::memory_order_acquire))
+            {
+                // A command posted before the brake must not come back through
+                // a kick still in progress. Zeroing from here as well covers a
+                // kick write that raced with brake().
+                command = MotorCommand();
+                for (MotorChannel &motor : motors)
+                {
+                    motor.kick = BreakawayKick();
+                }
+                set_motor_values(command.duty);
+            }
+            else if (motor_mailbox.take(command))
+            {
+                set_motor_values(command.duty);
+                io_latency.add(now_ns() - command.stamp_ns);
+            }
+            else if (kick_running())
+            {
+                set_motor_values(command.duty);
+            }
+
+            next_poll += poll_period;
+            std::this_thread::sleep_until(next_poll);
+        }
+
+        // Do not drop a command published right before the stop.
+        if (motor_mailbox.take(command))
+        {
+            set_motor_values(command.duty);
+        }
     }
 };
 
@@ -0,0 +1,141 @@
+#ifndef DIFFDRIVE_MINI_OCEBOT_DEADLINE_WATCHDOG_HPP
+#define DIFFDRIVE_MINI_OCEBOT_DEADLINE_WATCHDOG_HPP
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+
+#include "diffdrive_mini_ocebot/realtime.hpp"
+
+// Expects feed() at least once per deadline. The watchdog thread sleeps
+// until the deadline of the latest feed; if no newer feed arrived by then it
+// calls on_miss once, counts the miss and stays tripped until the next
+// feed(). feed() is one atomic exchange, so it can sit in write().
+class DeadlineWatchdog
+{
+    public:
+    typedef void (*MissCallback)(void *userdata);
+
+    DeadlineWatchdog() = default;
+    DeadlineWatchdog(const DeadlineWatchdog &) = delete;
+    DeadlineWatchdog &operator=(const DeadlineWatchdog &) = delete;
+
+    ~DeadlineWatchdog()
+    {
+        stop();
+    }
+
+    void start(std::chrono::nanoseconds deadline, MissCallback on_miss, void *userdata, const RealtimeConfig &realtime)
+    {
+        if (running)
+        {
+            return;
+        }
+
+        deadline_ns = deadline.count();
+        callback = on_miss;
+        callback_data = userdata;
+        tripped_flag = false;
+        feed();
+        running = true;
+        thread = std::thread(&DeadlineWatchdog::loop, this, realtime);
+    }
+
+    void stop()
+    {
+        {
+            std::lock_guard<std::mutex> lock(wake_mutex);
+            running = false;
+        }
+        wake.notify_all();
+        if (thread.joinable())
+        {
+            thread.join();
+        }
+    }
+
+    void feed()
+    {
+        const int64_t now = now_ns();
+        const int64_t previous = last_feed_ns.exchange(now, std::memory_order_acq_rel);
+        if (tripped_flag.load(std::memory_order_relaxed))
+        {
+            tripped_flag.store(false, std::memory_order_relaxed);
+            if (now - previous > longest_stall.load(std::memory_order_relaxed))
+            {
+                longest_stall.store(now - previous, std::memory_order_relaxed);
+            }
+        }
+    }
+
+    bool tripped() const
+    {
+        return tripped_flag.load(std::memory_order_relaxed);
+    }
+
+    uint64_t misses() const
+    {
+        return miss_count.load(std::memory_order_relaxed);
+    }
+
+    // Longest gap between two feeds that tripped the watchdog.
+    int64_t longest_stall_ns() const
+    {
+        return longest_stall.load(std::memory_order_relaxed);
+    }
+
+    void reset_stats()
+    {
+        miss_count = 0;
+        longest_stall = 0;
+    }
+
+    private:
+    int64_t deadline_ns = 0;
+    MissCallback callback = nullptr;
+    void *callback_data = nullptr;
+    std::atomic<int64_t> last_feed_ns{0};
+    std::atomic<bool> tripped_flag{false};
+    std::atomic<uint64_t> miss_count{0};
+    std::atomic<int64_t> longest_stall{0};
+    bool running = false;
+    std::mutex wake_mutex;
+    std::condition_variable wake;
+    std::thread thread;
+
+    static int64_t now_ns()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    void loop(RealtimeConfig realtime)
+    {
+        realtime.apply_to_current_thread("diffbot-wdog");
+
+        std::unique_lock<std::mutex> lock(wake_mutex);
+        int64_t missed_feed = -1;
+        while (running)
+        {
+            const int64_t fed = last_feed_ns.load(std::memory_order_acquire);
+            const int64_t now = now_ns();
+
+            if (fed != missed_feed && now - fed >= deadline_ns)
+            {
+                missed_feed = fed;
+                tripped_flag.store(true, std::memory_order_relaxed);
+                miss_count.fetch_add(1, std::memory_order_relaxed);
+                callback(callback_data);
+            }
+
+            // While tripped, look for the next feed once per deadline.
+            const int64_t wait_ns = fed == missed_feed ? deadline_ns : fed + deadline_ns - now;
+            wake.wait_for(lock, std::chrono::nanoseconds(wait_ns));
+        }
+    }
+};
+
+#endif
@@ -15,8 +15,10 @@
 #ifndef DIFFDRIVE_MINI_OCEBOT__DIFFBOT_SYSTEM_HPP_
 #define DIFFDRIVE_MINI_OCEBOT__DIFFBOT_SYSTEM_HPP_
 
+#include <atomic>
 #include <memory>
 #include <string>
+#include <thread>
 #include <vector>
 
 #include "hardware_interface/handle.hpp"
@@ -33,28 +35,99 @@
 #include "diffdrive_mini_ocebot/visibility_control.h"
 #include "diffdrive_mini_ocebot/wheel.hpp"
 #include "diffdrive_mini_ocebot/controller.hpp"
+#include "diffdrive_mini_ocebot/deadline_watchdog.hpp"
+#include "diffdrive_mini_ocebot/edge_odometry.hpp"
+#include "diffdrive_mini_ocebot/duty_velocity_table.hpp"
+#include "diffdrive_mini_ocebot/event_log.hpp"
+#include "diffdrive_mini_ocebot/fopdt_model.hpp"
+#include "diffdrive_mini_ocebot/latency_histogram.hpp"
+#include "diffdrive_mini_ocebot/latest_value_slot.hpp"
+#include "diffdrive_mini_ocebot/realtime.hpp"
+#include "diffdrive_mini_ocebot/sim_motor_backend.hpp"
+#include "diffdrive_mini_ocebot/wheel_pid.hpp"
 
 namespace diffdrive_mini_ocebot
 {
 class DiffBotSystemHardware : public hardware_interface::SystemInterface
 {
 
-struct Config 
+// Pins and side of one wheel joint, in info_.joints order.
+struct WheelConfig
 {
-  std::string left_wheel_name = "";
-  std::string right_wheel_name = "";
-  int left_wheel_pin = 0;
-  int right_wheel_pin = 0;
-  int left_direction_pin = 0;
-  int right_direction_pin = 0;
-  int left_enc_pin = 0;
-  int right_enc_pin = 0;
+  std::string name = "";
+  MotorPins pins;
   unsigned enc_counts_per_rev = 0;
+  // EdgeOdometry::LEFT or RIGHT, 0 when not given.
+  int side = 0;
+};
+
+struct Config 
+{
+  std::vector<WheelConfig> wheels;
+  std::string gpio_backend = "pigpiod";
+  std::string gpio_device = "";
+  bool async_io = false;
+  int io_poll_period_us = 200;
+  bool edge_velocity = true;
+  unsigned velocity_edge_threshold = 10;
+  double velocity_timeout = 0.5;
+  bool closed_loop = false;
+  double pid_kp = 0;
+  double pid_ki = 0;
+  double pid_kd = 0;
+  double pid_kff = 10;
+  double pid_friction_duty = 0;
+  double pid_i_clamp = 50;
+  double pid_output_limit = 115;
+  double inner_loop_rate = 0;
+  RealtimeConfig realtime;
+  double sim_motor_gain = 20;
+  double sim_motor_time_constant = 0.05;
+  double sim_motor_deadband = 0.1;
+  double sim_time_scale = 1.0;
+  double diagnostics_period = 1.0;
+  bool pwm_hardware = false;
+  unsigned pwm_frequency = 0;
+  unsigned pwm_range = 255;
+  double breakaway_duty = 0;
+  double breakaway_time_ms = 5;
+  double min_duty = 0;
+  bool duty_table = false;
+  std::string duty_table_file = "";
+  bool duty_calibration = false;
+  unsigned calibration_steps = 16;
+  double calibration_settle_time = 1.0;
+  double calibration_measure_time = 1.0;
+  bool system_identification = false;
+  std::string system_id_file = "";
+  double update_rate = 10;
+  double write_deadline_ms = 0;
+  double wheel_separation = 0;
+  double wheel_radius = 0;
+  std::string event_log = "";
+  unsigned long event_log_capacity = 1 << 20;
+};
+
+struct WheelCommands
+{
+  double cmd[Controller::MAX_MOTORS] = {};
+};
+
+struct WheelStates
+{
+  double pos[Controller::MAX_MOTORS] = {};
+  double vel[Controller::MAX_MOTORS] = {};
+  double x = 0;
+  double y = 0;
+  double theta = 0;
 };
 
 public:
   RCLCPP_SHARED_PTR_DEFINITIONS(DiffBotSystemHardware);
 
+  DIFFDRIVE_MINI_OCEBOT_PUBLIC
+  ~DiffBotSystemHardware() override;
+
   DIFFDRIVE_MINI_OCEBOT_PUBLIC
   hardware_interface::CallbackReturn on_init(
     const hardware_interface::HardwareInfo & info) override;
@@ -91,9 +164,80 @@ public:
 
 private:
   Config cfg_;
-  Wheel wheel_left_;
-  Wheel wheel_right_;
+  // One entry per joint, in info_.joints order.
+  WheelArray wheels_;
+  std::vector<WheelPid> pids_;
+  // Sign of the last non-zero duty per wheel. Single-channel encoders count
+  // up in both directions, so their speed takes this sign before the PID.
+  std::vector<int> drive_signs_;
+  std::vector<DutyVelocityTable> duty_tables_;
   Controller gpio_controller_;
+  EventLog event_log_;
+  // Set when a simulated backend is stepped from read() instead of its own
+  // thread (sim_time_scale <= 0).
+  SimBackend * sim_clock_ = nullptr;
+
+  // Inner loop: samples the encoders and drives the motors at
+  // inner_loop_rate, independent of the controller_manager update rate.
+  // read()/write() only exchange the latest snapshots with it.
+  LatestValueSlot<WheelCommands> command_slot_;
+  LatestValueSlot<WheelStates> state_slot_;
+  std::atomic<bool> inner_loop_running_{false};
+  std::thread inner_loop_thread_;
+
+  // Duty calibration sweep and system identification. While they run they
+  // own the motors and the edge rings: command_motors does nothing and the
+  // wheel states follow the encoder counters only.
+  std::atomic<bool> experiment_running_{false};
+  std::thread experiment_thread_;
+
+  // Brakes the motors when write() is not called within write_deadline_ms,
+  // e.g. because the controller_manager thread stalled. While tripped,
+  // the inner loop drives zero instead of the last command.
+  DeadlineWatchdog write_watchdog_;
+  double watchdog_misses_ = 0;
+  // The write() periods of the first cycles after activation, compared once
+  // with update_rate, which the startup checks had to assume.
+  double write_period_sum_ = 0;
+  unsigned write_period_samples_ = 0;
+
+  // Pose integrated from the encoder edges of all wheels (wheels_.tracks),
+  // when wheel_separation and wheel_radius are set. Integrated by whichever
+  // thread samples the wheels; pose_ is the copy exported by read().
+  EdgeOdometry odometry_;
+  double pose_[3] = {};
+
+  // Loop timing diagnostics: read period, write duration, backend call and
+  // encoder callback latency. Percentiles and max are refreshed from the
+  // histograms every diagnostics_period and exported in microseconds.
+  static constexpr size_t kDiagnosticMetrics = 4;
+  static constexpr size_t kDiagnosticStats = 4;
+  LatencyHistogram read_period_hist_;
+  LatencyHistogram write_duration_hist_;
+  double diagnostics_[kDiagnosticMetrics][kDiagnosticStats] = {};
+  double diagnostics_elapsed_ = 0;
+
+  void setup_sim_motors(SimMotorBackend & plant);
+  void start_inner_loop();
+  void stop_inner_loop();
+  void inner_loop();
+  void command_motors(const double * cmd, const double * vel, double delta_seconds);
+  void send_motor_values(const int * duties);
+  void drive_all_motors(int duty);
+  bool load_wheel_duty_tables();
+  void update_diagnostics();
+  void check_write_period(double period_ms) const;
+  bool odometry_enabled() const
+  {
+    return cfg_.wheel_separation > 0 && cfg_.wheel_radius > 0;
+  }
+  static void brake_on_missed_write(void * self);
+  void start_experiments();
+  void stop_experiments();
+  bool experiment_wait(double seconds);
+  void run_experiments();
+  void calibrate_duty_tables();
+  void identify_motors();
 };
 
 }  // namespace diffdrive_mini_ocebot
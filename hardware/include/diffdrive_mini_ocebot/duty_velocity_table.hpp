@@ -0,0 +1,212 @@
+#ifndef DIFFDRIVE_MINI_OCEBOT_DUTY_VELOCITY_TABLE_HPP
+#define DIFFDRIVE_MINI_OCEBOT_DUTY_VELOCITY_TABLE_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Measured mapping from wheel speed to the duty that holds it, per
+// direction, for motors whose response is far from linear (dead band at the
+// bottom, saturation at the top). Duties are in steps of the default 0-255
+// range, like the open-loop factor and the PID limits.
+//
+// fit() turns the raw (duty, speed) points of a calibration sweep into a
+// monotone curve: speeds are made non-decreasing in duty, the dead band
+// collapses into its last duty (the breakaway duty for speeds just above
+// zero), and the curve is resampled on a uniform speed grid. lookup() is
+// then an index computation and one linear interpolation without branches.
+class DutyVelocityTable
+{
+    public:
+    static constexpr size_t FORWARD = 0;
+    static constexpr size_t REVERSE = 1;
+    static constexpr size_t GRID = 64;
+    // Speeds below this fraction of the top speed count as standing still.
+    static constexpr double DEAD_BAND_FRACTION = 0.02;
+
+    bool valid = false;
+
+    void clear()
+    {
+        valid = false;
+        measured[FORWARD].clear();
+        measured[REVERSE].clear();
+    }
+
+    void add_point(size_t direction, double duty, double speed)
+    {
+        measured[direction].emplace_back(duty, std::fabs(speed));
+    }
+
+    const std::vector<std::pair<double, double>> &points(size_t direction) const
+    {
+        return measured[direction];
+    }
+
+    bool fit()
+    {
+        valid = fit_direction(FORWARD) && fit_direction(REVERSE);
+        return valid;
+    }
+
+    // Signed duty for a signed wheel speed. Speeds beyond the fastest
+    // measured one get the top duty, zero gets zero.
+    double lookup(double velocity) const
+    {
+        const size_t direction = velocity < 0;
+        const double speed = std::fabs(velocity);
+        const double x = std::min(speed * inverse_step[direction], static_cast<double>(GRID - 1));
+        const size_t index = std::min(static_cast<size_t>(x), GRID - 2);
+        const double fraction = x - static_cast<double>(index);
+        const double *duty = grid[direction];
+        const double magnitude = duty[index] + fraction * (duty[index + 1] - duty[index]);
+        return std::copysign(magnitude, velocity) * static_cast<double>(speed > 0);
+    }
+
+    private:
+    std::vector<std::pair<double, double>> measured[2];
+    double grid[2][GRID] = {};
+    double inverse_step[2] = {0, 0};
+
+    bool fit_direction(size_t direction)
+    {
+        std::vector<std::pair<double, double>> points = measured[direction];
+        std::sort(points.begin(), points.end());
+        if (points.empty())
+        {
+            return false;
+        }
+
+        double top_speed = 0;
+        for (std::pair<double, double> &point : points)
+        {
+            top_speed = std::max(top_speed, point.second);
+            point.second = top_speed;
+        }
+        if (top_speed <= 0)
+        {
+            return false;
+        }
+
+        // (speed, duty) knots with strictly increasing speed, starting at
+        // the breakaway duty.
+        const double still = DEAD_BAND_FRACTION * top_speed;
+        std::vector<std::pair<double, double>> knots;
+        double breakaway = 0;
+        for (const std::pair<double, double> &point : points)
+        {
+            if (point.second <= still)
+            {
+                breakaway = point.first;
+            }
+            else if (knots.empty() || point.second > knots.back().first)
+            {
+                knots.emplace_back(point.second, point.first);
+            }
+        }
+        if (knots.size() < 2)
+        {
+            return false;
+        }
+        knots.insert(knots.begin(), {0.0, breakaway});
+
+        const double step = knots.back().first / (GRID - 1);
+        size_t knot = 0;
+        for (size_t i = 0; i < GRID; i++)
+        {
+            double speed = step * i;
+            while (knot + 2 < knots.size() && knots[knot + 1].first < speed)
+            {
+                knot++;
+            }
+            const std::pair<double, double> &low = knots[knot];
+            const std::pair<double, double> &high = knots[knot + 1];
+            double fraction = std::clamp((speed - low.first) / (high.first - low.first), 0.0, 1.0);
+            grid[direction][i] = low.second + fraction * (high.second - low.second);
+        }
+        inverse_step[direction] = 1.0 / step;
+        return true;
+    }
+};
+
+// Text file with one measured point per line: wheel name, "forward" or
+// "reverse", duty and speed in rad/s. Lines starting with # are comments.
+inline bool save_duty_tables(const std::string &path, const std::vector<std::pair<std::string, const DutyVelocityTable *>> &tables)
+{
+    std::ofstream file(path);
+    if (!file)
+    {
+        return false;
+    }
+
+    file << "# wheel direction duty(0-255) speed(rad/s)\n";
+    for (const auto &table : tables)
+    {
+        for (size_t direction : {DutyVelocityTable::FORWARD, DutyVelocityTable::REVERSE})
+        {
+            for (const std::pair<double, double> &point : table.second->points(direction))
+            {
+                file << table.first << (direction == DutyVelocityTable::FORWARD ? " forward " : " reverse ")
+                     << point.first << " " << point.second << "\n";
+            }
+        }
+    }
+    return static_cast<bool>(file);
+}
+
+// Fills and fits the tables of the named wheels. Returns false if the file
+// cannot be read or a table does not fit.
+inline bool load_duty_tables(const std::string &path, const std::vector<std::pair<std::string, DutyVelocityTable *>> &tables)
+{
+    std::ifstream file(path);
+    if (!file)
+    {
+        return false;
+    }
+
+    for (const auto &table : tables)
+    {
+        table.second->clear();
+    }
+
+    std::string line;
+    while (std::getline(file, line))
+    {
+        if (line.empty() || line[0] == '#')
+        {
+            continue;
+        }
+
+        std::istringstream fields(line);
+        std::string wheel;
+        std::string direction;
+        double duty;
+        double speed;
+        if (!(fields >> wheel >> direction >> duty >> speed))
+        {
+            return false;
+        }
+
+        for (const auto &table : tables)
+        {
+            if (table.first == wheel)
+            {
+                table.second->add_point(direction == "reverse" ? DutyVelocityTable::REVERSE : DutyVelocityTable::FORWARD, duty, speed);
+            }
+        }
+    }
+
+    bool fitted = true;
+    for (const auto &table : tables)
+    {
+        fitted = table.second->fit() && fitted;
+    }
+    return fitted;
+}
+
+#endif
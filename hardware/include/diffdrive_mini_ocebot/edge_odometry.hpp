@@ -0,0 +1,142 @@
+#ifndef DIFFDRIVE_MINI_OCEBOT_EDGE_ODOMETRY_HPP
+#define DIFFDRIVE_MINI_OCEBOT_EDGE_ODOMETRY_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "diffdrive_mini_ocebot/edge_timestamp_ring.hpp"
+
+// Encoder edges of one wheel taken out of its ring during one sample, in
+// arrival order. Holds a full ring, so nothing is lost unless the ring
+// itself overran.
+struct EdgeTrack
+{
+    static constexpr size_t CAPACITY = 4096;
+
+    EncoderEdge edges[CAPACITY];
+    size_t count = 0;
+
+    void add(const EncoderEdge &edge)
+    {
+        if (count < CAPACITY)
+        {
+            edges[count++] = edge;
+        }
+    }
+};
+
+// Planar pose of a differential drive integrated edge by edge. Every counted
+// edge moves one side by one count (divided among the wheels on that side)
+// while the other side stands still, which is an exact circular arc about
+// the standing side. Edges of all wheels are merged in tick order first, so
+// curves are followed at encoder resolution whatever the sample rate. The
+// arc of one count is fixed, so its chord and heading change are computed
+// once in setup().
+//
+// Counts follow the joint positions: positive is forward for every wheel,
+// and single-channel encoders only count up.
+class EdgeOdometry
+{
+    public:
+    double x = 0;
+    double y = 0;
+    double theta = 0;
+
+    static constexpr int LEFT = -1;
+    static constexpr int RIGHT = 1;
+
+    // Per wheel: radians per count and side (LEFT or RIGHT).
+    void setup(const std::vector<double> &rads_per_count, const std::vector<int> &sides, double wheel_radius, double wheel_separation)
+    {
+        size_t per_side[2] = {0, 0};
+        for (int side : sides)
+        {
+            per_side[side == RIGHT]++;
+        }
+
+        arcs.assign(sides.size(), CountArc());
+        heads.assign(sides.size(), 0);
+        for (size_t i = 0; i < sides.size(); i++)
+        {
+            const double travel = rads_per_count[i] * wheel_radius / per_side[sides[i] == RIGHT];
+            setup_wheel(arcs[i], travel, sides[i] / wheel_separation);
+        }
+        reset();
+    }
+
+    void reset()
+    {
+        x = 0;
+        y = 0;
+        theta = 0;
+    }
+
+    // Integrates and empties the tracks, one per wheel as in setup().
+    void integrate(EdgeTrack *tracks)
+    {
+        const size_t wheels = arcs.size();
+        std::fill(heads.begin(), heads.end(), 0);
+        while (true)
+        {
+            // Oldest pending edge. Unsigned tick differences survive the
+            // 32-bit microsecond wrap.
+            size_t next = wheels;
+            for (size_t i = 0; i < wheels; i++)
+            {
+                if (heads[i] < tracks[i].count &&
+                    (next == wheels ||
+                    static_cast<int32_t>(tracks[i].edges[heads[i]].tick - tracks[next].edges[heads[next]].tick) < 0))
+                {
+                    next = i;
+                }
+            }
+            if (next == wheels)
+            {
+                break;
+            }
+            step(arcs[next], tracks[next].edges[heads[next]++].step);
+        }
+
+        for (size_t i = 0; i < wheels; i++)
+        {
+            tracks[i].count = 0;
+        }
+        theta = std::remainder(theta, 2 * M_PI);
+    }
+
+    private:
+    // Chord and heading change of one forward count of a wheel.
+    struct CountArc
+    {
+        double chord = 0;
+        double heading = 0;
+    };
+
+    std::vector<CountArc> arcs;
+    std::vector<size_t> heads;
+
+    // The robot centre moves half the side's travel, on an arc that turns
+    // the heading by travel / separation (sign by side).
+    static void setup_wheel(CountArc &arc, double travel, double turn_per_metre)
+    {
+        const double distance = travel / 2;
+        arc.heading = travel * turn_per_metre;
+        const double half = arc.heading / 2;
+        arc.chord = half == 0 ? distance : distance * std::sin(half) / half;
+    }
+
+    void step(const CountArc &arc, int32_t count)
+    {
+        const double chord = count * arc.chord;
+        const double heading = count * arc.heading;
+        const double direction = theta + heading / 2;
+        x += chord * std::cos(direction);
+        y += chord * std::sin(direction);
+        theta += heading;
+    }
+};
+
+#endif
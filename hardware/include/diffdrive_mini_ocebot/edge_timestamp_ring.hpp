@@ -0,0 +1,77 @@
+#ifndef DIFFDRIVE_MINI_OCEBOT_EDGE_TIMESTAMP_RING_HPP
+#define DIFFDRIVE_MINI_OCEBOT_EDGE_TIMESTAMP_RING_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+// One counted encoder edge: the GPIO tick in microseconds and the count step
+// it produced (+1 or -1).
+struct EncoderEdge
+{
+    uint32_t tick = 0;
+    int32_t step = 0;
+};
+
+// Lock-free single-producer/single-consumer ring of encoder edges. The GPIO
+// callback thread pushes, read() drains. When the consumer falls behind the
+// producer drops the new edge and counts an overrun instead of blocking;
+// the encoder count itself is kept separately and is never lost.
+template <size_t Capacity>
+class EdgeTimestampRing
+{
+    static_assert((Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+
+    public:
+    EdgeTimestampRing() = default;
+    EdgeTimestampRing(const EdgeTimestampRing &) = delete;
+    EdgeTimestampRing &operator=(const EdgeTimestampRing &) = delete;
+
+    bool push(uint32_t tick, int32_t step)
+    {
+        size_t h = head.load(std::memory_order_relaxed);
+        if (h - tail.load(std::memory_order_acquire) == Capacity)
+        {
+            overruns.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+
+        slots[h & (Capacity - 1)] = {tick, step};
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool pop(EncoderEdge &edge)
+    {
+        size_t t = tail.load(std::memory_order_relaxed);
+        if (t == head.load(std::memory_order_acquire))
+        {
+            return false;
+        }
+
+        edge = slots[t & (Capacity - 1)];
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer side only.
+    void clear()
+    {
+        tail.store(head.load(std::memory_order_acquire), std::memory_order_release);
+    }
+
+    uint64_t dropped() const
+    {
+        return overruns.load(std::memory_order_relaxed);
+    }
+
+    private:
+    alignas(64) std::atomic<size_t> head{0};
+    alignas(64) std::atomic<size_t> tail{0};
+    alignas(64) std::atomic<uint64_t> overruns{0};
+    EncoderEdge slots[Capacity];
+};
+
+typedef EdgeTimestampRing<4096> EncoderEdgeRing;
+
+#endif
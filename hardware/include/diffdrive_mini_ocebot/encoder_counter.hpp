@@ -0,0 +1,32 @@
+#ifndef DIFFDRIVE_MINI_OCEBOT_ENCODER_COUNTER_HPP
+#define DIFFDRIVE_MINI_OCEBOT_ENCODER_COUNTER_HPP
+
+#include <atomic>
+#include <cstdint>
+
+// Encoder count shared between the GPIO callback thread and read(). Aligned
+// to a full cache line so the callback's writes do not invalidate the line
+// holding the wheel's cmd/pos/vel.
+struct alignas(64) EncoderCounter
+{
+    std::atomic<int64_t> count{0};
+
+    void add(int64_t delta)
+    {
+        count.fetch_add(delta, std::memory_order_relaxed);
+    }
+
+    int64_t snapshot() const
+    {
+        return count.load(std::memory_order_acquire);
+    }
+
+    void reset()
+    {
+        count.store(0, std::memory_order_release);
+    }
+};
+
+static_assert(sizeof(EncoderCounter) == 64, "EncoderCounter must fill exactly one cache line");
+
+#endif
@@ -0,0 +1,210 @@
+#ifndef DIFFDRIVE_MINI_OCEBOT_EVENT_LOG_HPP
+#define DIFFDRIVE_MINI_OCEBOT_EVENT_LOG_HPP
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+// One GPIO event. EDGE and INPUT_LEVEL carry the input level in value, WRITE
+// the output level and PWM the duty cycle. Ticks are the backend's edge
+// ticks; stamp_ns is steady_clock time when the event was recorded.
+struct EventRecord
+{
+    enum Type : uint8_t
+    {
+        EDGE = 0,
+        WRITE = 1,
+        PWM = 2,
+        INPUT_LEVEL = 3
+    };
+
+    uint64_t stamp_ns;
+    uint32_t tick;
+    uint8_t pin;
+    uint8_t type;
+    uint16_t value;
+};
+
+static_assert(sizeof(EventRecord) == 16, "EventRecord is the on-disk record layout");
+
+// Fixed-size ring of EventRecords in a memory-mapped file. The file is sized
+// and its pages faulted in when it is created, so append() is a fetch_add and
+// a 16 byte store: no allocation and no system call. Any number of threads
+// may append; once the ring is full the oldest records are overwritten.
+//
+// The file is a Header followed by capacity records. head counts every
+// record ever appended, so the newest record lives at (head - 1) % capacity.
+class EventLog
+{
+    public:
+    static constexpr char MAGIC[8] = {'D', 'B', 'O', 'T', 'L', 'O', 'G', '1'};
+
+    struct Header
+    {
+        char magic[8];
+        uint32_t record_size;
+        uint32_t reserved;
+        uint64_t capacity;
+        std::atomic<uint64_t> head;
+    };
+
+    EventLog() = default;
+    EventLog(const EventLog &) = delete;
+    EventLog &operator=(const EventLog &) = delete;
+
+    ~EventLog()
+    {
+        close();
+    }
+
+    // Creates or truncates the file for recording.
+    bool create(const std::string &path, uint64_t capacity)
+    {
+        close();
+        if (capacity == 0)
+        {
+            return false;
+        }
+
+        int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0)
+        {
+            return false;
+        }
+
+        size_t bytes = sizeof(Header) + capacity * sizeof(EventRecord);
+        if (ftruncate(fd, static_cast<off_t>(bytes)) != 0)
+        {
+            ::close(fd);
+            return false;
+        }
+
+        void *memory = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, 0);
+        ::close(fd);
+        if (memory == MAP_FAILED)
+        {
+            return false;
+        }
+
+        map(memory, bytes);
+        std::memcpy(header->magic, MAGIC, sizeof(MAGIC));
+        header->record_size = sizeof(EventRecord);
+        header->reserved = 0;
+        header->capacity = capacity;
+        header->head.store(0, std::memory_order_release);
+        writable = true;
+        return true;
+    }
+
+    // Maps an existing log read-only for replay.
+    bool open(const std::string &path)
+    {
+        close();
+
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+        {
+            return false;
+        }
+
+        struct stat info;
+        if (fstat(fd, &info) != 0 || static_cast<size_t>(info.st_size) < sizeof(Header))
+        {
+            ::close(fd);
+            return false;
+        }
+
+        size_t bytes = static_cast<size_t>(info.st_size);
+        void *memory = mmap(nullptr, bytes, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (memory == MAP_FAILED)
+        {
+            return false;
+        }
+
+        map(memory, bytes);
+        if (std::memcmp(header->magic, MAGIC, sizeof(MAGIC)) != 0 || header->record_size != sizeof(EventRecord) ||
+            sizeof(Header) + header->capacity * sizeof(EventRecord) > bytes)
+        {
+            close();
+            return false;
+        }
+
+        writable = false;
+        return true;
+    }
+
+    void close()
+    {
+        if (base != nullptr)
+        {
+            munmap(base, mapped_bytes);
+        }
+        base = nullptr;
+        header = nullptr;
+        records = nullptr;
+        mapped_bytes = 0;
+        writable = false;
+    }
+
+    bool recording() const
+    {
+        return writable;
+    }
+
+    void append(EventRecord::Type type, unsigned pin, unsigned value, uint32_t tick = 0)
+    {
+        uint64_t slot = header->head.fetch_add(1, std::memory_order_relaxed) % header->capacity;
+        EventRecord &record = records[slot];
+        record.stamp_ns = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count());
+        record.tick = tick;
+        record.pin = static_cast<uint8_t>(pin);
+        record.type = type;
+        record.value = static_cast<uint16_t>(value);
+    }
+
+    // Records still held by the ring, oldest first.
+    uint64_t size() const
+    {
+        uint64_t head = header->head.load(std::memory_order_acquire);
+        return head < header->capacity ? head : header->capacity;
+    }
+
+    // Records lost to wrap-around.
+    uint64_t overwritten() const
+    {
+        return header->head.load(std::memory_order_acquire) - size();
+    }
+
+    const EventRecord &at(uint64_t index) const
+    {
+        uint64_t head = header->head.load(std::memory_order_acquire);
+        uint64_t oldest = head < header->capacity ? 0 : head % header->capacity;
+        return records[(oldest + index) % header->capacity];
+    }
+
+    private:
+    void *base = nullptr;
+    size_t mapped_bytes = 0;
+    Header *header = nullptr;
+    EventRecord *records = nullptr;
+    bool writable = false;
+
+    void map(void *memory, size_t bytes)
+    {
+        base = memory;
+        mapped_bytes = bytes;
+        header = static_cast<Header *>(memory);
+        records = reinterpret_cast<EventRecord *>(static_cast<unsigned char *>(memory) + sizeof(Header));
+    }
+};
+
+#endif
@@ -0,0 +1,185 @@
+#ifndef DIFFDRIVE_MINI_OCEBOT_FOPDT_MODEL_HPP
+#define DIFFDRIVE_MINI_OCEBOT_FOPDT_MODEL_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <fstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+// First-order-plus-dead-time model of one motor: the wheel speed (rad/s)
+// follows the duty (steps of the default 0-255 range) as
+//
+//     gain / (time_constant * s + 1) * exp(-dead_time * s)
+//
+// above a friction offset of deadband_duty. fit() identifies it from a
+// uniformly sampled duty/speed record with the discrete form
+//
+//     v[k+1] = a * v[k] + b * u[k-d] + c
+//
+// solved by least squares for each dead time d up to max_delay samples,
+// keeping the d with the smallest residual. Then a = exp(-T / time_constant),
+// gain = b / (1 - a) and deadband_duty = -c / b.
+struct FopdtModel
+{
+    double gain = 0;
+    double time_constant = 0;
+    double dead_time = 0;
+    double deadband_duty = 0;
+    double rms_error = 0;
+    bool valid = false;
+
+    // Samples before first are only used as delayed inputs, so the fit can
+    // skip a start-up transient such as breaking away from standstill.
+    bool fit(const std::vector<double> &duty, const std::vector<double> &speed, double sample_period, size_t first, size_t max_delay)
+    {
+        valid = false;
+        const size_t samples = std::min(duty.size(), speed.size());
+        first = std::max(first, max_delay);
+        if (sample_period <= 0 || samples < first + 4)
+        {
+            return false;
+        }
+
+        double best_error = -1;
+        for (size_t delay = 0; delay <= max_delay; delay++)
+        {
+            // Normal equations of [v[k] u[k-d] 1] * [a b c]' = v[k+1].
+            double m[3][4] = {};
+            for (size_t k = first; k + 1 < samples; k++)
+            {
+                const double x[3] = {speed[k], duty[k - delay], 1.0};
+                for (size_t row = 0; row < 3; row++)
+                {
+                    for (size_t col = 0; col < 3; col++)
+                    {
+                        m[row][col] += x[row] * x[col];
+                    }
+                    m[row][3] += x[row] * speed[k + 1];
+                }
+            }
+
+            double p[3];
+            if (!solve(m, p))
+            {
+                continue;
+            }
+
+            double error = 0;
+            for (size_t k = first; k + 1 < samples; k++)
+            {
+                const double residual = speed[k + 1] - (p[0] * speed[k] + p[1] * duty[k - delay] + p[2]);
+                error += residual * residual;
+            }
+
+            const double a = p[0];
+            const double b = p[1];
+            if (a <= 0 || a >= 1 || b <= 0 || (best_error >= 0 && error >= best_error))
+            {
+                continue;
+            }
+
+            best_error = error;
+            gain = b / (1 - a);
+            time_constant = -sample_period / std::log(a);
+            dead_time = delay * sample_period;
+            deadband_duty = -p[2] / b;
+            rms_error = std::sqrt(error / (samples - 1 - first));
+            valid = true;
+        }
+        return valid;
+    }
+
+    // PI gains for the wheel PID by the SIMC rules, with a closed-loop time
+    // constant of at least half the open-loop one. The feedforward inverts
+    // the static model, friction offset included: duty = friction + v / gain
+    // in the direction of v, matching control_mode=pid's pid_friction_duty
+    // and pid_kff.
+    void suggest_pid(double &kp, double &ki, double &kff, double &friction) const
+    {
+        const double closed_loop_time = std::max(dead_time, 0.5 * time_constant);
+        kp = time_constant / (gain * (closed_loop_time + dead_time));
+        ki = kp / std::min(time_constant, 4 * (closed_loop_time + dead_time));
+        kff = 1 / gain;
+        friction = std::max(deadband_duty, 0.0);
+    }
+
+    private:
+    // Gaussian elimination with partial pivoting on an augmented 3x4 matrix.
+    static bool solve(double m[3][4], double p[3])
+    {
+        for (size_t col = 0; col < 3; col++)
+        {
+            size_t pivot = col;
+            for (size_t row = col + 1; row < 3; row++)
+            {
+                if (std::fabs(m[row][col]) > std::fabs(m[pivot][col]))
+                {
+                    pivot = row;
+                }
+            }
+            if (std::fabs(m[pivot][col]) < 1e-12)
+            {
+                return false;
+            }
+            std::swap(m[col], m[pivot]);
+
+            for (size_t row = col + 1; row < 3; row++)
+            {
+                const double factor = m[row][col] / m[col][col];
+                for (size_t k = col; k < 4; k++)
+                {
+                    m[row][k] -= factor * m[col][k];
+                }
+            }
+        }
+
+        for (size_t row = 3; row-- > 0;)
+        {
+            double sum = m[row][3];
+            for (size_t k = row + 1; k < 3; k++)
+            {
+                sum -= m[row][k] * p[k];
+            }
+            p[row] = sum / m[row][row];
+        }
+        return true;
+    }
+};
+
+// YAML file with one block per wheel: the model and the PID gains it
+// suggests.
+inline bool save_fopdt_models(const std::string &path, const std::vector<std::pair<std::string, const FopdtModel *>> &models)
+{
+    std::ofstream file(path);
+    if (!file)
+    {
+        return false;
+    }
+
+    file << "# First-order-plus-dead-time fit per wheel, speed in rad/s over duty in\n"
+         << "# steps of 0-255: gain / (time_constant s + 1) exp(-dead_time s).\n";
+    for (const auto &model : models)
+    {
+        double kp;
+        double ki;
+        double kff;
+        double friction;
+        model.second->suggest_pid(kp, ki, kff, friction);
+        file << model.first << ":\n"
+             << "  gain: " << model.second->gain << "\n"
+             << "  time_constant: " << model.second->time_constant << "\n"
+             << "  dead_time: " << model.second->dead_time << "\n"
+             << "  deadband_duty: " << model.second->deadband_duty << "\n"
+             << "  rms_error: " << model.second->rms_error << "\n"
+             << "  pid_kp: " << kp << "\n"
+             << "  pid_ki: " << ki << "\n"
+             << "  pid_kff: " << kff << "\n"
+             << "  pid_friction_duty: " << friction << "\n";
+    }
+    return static_cast<bool>(file);
+}
+
+#endif
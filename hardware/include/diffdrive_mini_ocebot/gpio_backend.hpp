@@ -0,0 +1,63 @@
+#ifndef DIFFDRIVE_MINI_OCEBOT_GPIO_BACKEND_HPP
+#define DIFFDRIVE_MINI_OCEBOT_GPIO_BACKEND_HPP
+
+#include <cstdint>
+
+#include "diffdrive_mini_ocebot/realtime.hpp"
+
+// Edge callback shared by every backend. Same shape as pigpio's callback_ex
+// without the daemon handle: gpio, new level (0/1) and a microsecond tick.
+typedef void (*GpioEdgeCallback)(unsigned gpio, unsigned level, uint32_t tick, void *userdata);
+
+// Minimal set of GPIO operations the Controller needs. Return values follow
+// the pigpio convention: >= 0 on success, < 0 on error.
+class GpioBackend
+{
+    public:
+    enum Mode
+    {
+        INPUT = 0,
+        OUTPUT = 1
+    };
+
+    // Applied by backends that run their own threads.
+    RealtimeConfig realtime;
+
+    virtual ~GpioBackend() = default;
+
+    virtual const char *name() const = 0;
+
+    virtual bool connect() = 0;
+    virtual void disconnect() = 0;
+
+    virtual int set_mode(unsigned gpio, Mode mode) = 0;
+    virtual int read(unsigned gpio) = 0;
+    virtual int write(unsigned gpio, unsigned level) = 0;
+
+    // Duty cycle is in 0..range, where range is the 255 of pigpio's software
+    // PWM unless configure_pwm chose another.
+    virtual int set_pwm_dutycycle(unsigned gpio, unsigned duty) = 0;
+    virtual int get_pwm_dutycycle(unsigned gpio) = 0;
+
+    // Sets the duty range and frequency (0 = backend default) of an output
+    // pin. With hardware set, a PWM peripheral channel is used if the pin has
+    // a free one. Returns 1 for hardware PWM, 0 for software PWM and < 0 on
+    // error.
+    virtual int configure_pwm(unsigned gpio, unsigned frequency, unsigned range, bool hardware) = 0;
+
+    // Returns a callback id to pass to cancel_edge_callback.
+    virtual int add_edge_callback(unsigned gpio, GpioEdgeCallback callback, void *userdata) = 0;
+    virtual int cancel_edge_callback(int id) = 0;
+
+    // Bracket a batch of add_edge_callback/cancel_edge_callback calls, for
+    // backends that have to re-request their edge lines on every change.
+    // Such a backend applies the batch in end_edge_changes, which returns
+    // < 0 if that failed.
+    virtual void begin_edge_changes() {}
+    virtual int end_edge_changes()
+    {
+        return 0;
+    }
+};
+
+#endif
@@ -0,0 +1,67 @@
+#ifndef DIFFDRIVE_MINI_OCEBOT_GPIO_BACKEND_FACTORY_HPP
+#define DIFFDRIVE_MINI_OCEBOT_GPIO_BACKEND_FACTORY_HPP
+
+#include <memory>
+#include <string>
+
+#include "diffdrive_mini_ocebot/gpio_backend.hpp"
+#include "diffdrive_mini_ocebot/replay_backend.hpp"
+#include "diffdrive_mini_ocebot/sim_backend.hpp"
+#include "diffdrive_mini_ocebot/sim_motor_backend.hpp"
+
+#ifdef DIFFDRIVE_MINI_OCEBOT_WITH_PIGPIOD
+#include "diffdrive_mini_ocebot/pigpiod_backend.hpp"
+#include "diffdrive_mini_ocebot/pigpiod_notify_backend.hpp"
+#endif
+#ifdef DIFFDRIVE_MINI_OCEBOT_WITH_PIGPIO
+#include "diffdrive_mini_ocebot/pigpio_backend.hpp"
+#endif
+#ifdef DIFFDRIVE_MINI_OCEBOT_WITH_LIBGPIOD
+#include "diffdrive_mini_ocebot/libgpiod_backend.hpp"
+#endif
+
+// Creates the backend named by the `gpio_backend` hardware parameter. The
+// device is the pigpiod host[:port] for "pigpiod" and "pigpiod_notify", the
+// gpiochip path for "libgpiod" and the event log for "replay"; an empty
+// string keeps the backend default. Returns nullptr for unknown names and
+// for backends that were not compiled in.
+inline std::unique_ptr<GpioBackend> make_gpio_backend(const std::string &type, const std::string &device = "")
+{
+    if (type == "sim")
+    {
+        return std::make_unique<SimBackend>();
+    }
+    if (type == "sim_motor")
+    {
+        return std::make_unique<SimMotorBackend>();
+    }
+    if (type == "replay")
+    {
+        return std::make_unique<ReplayBackend>(device);
+    }
+#ifdef DIFFDRIVE_MINI_OCEBOT_WITH_PIGPIOD
+    if (type == "pigpiod")
+    {
+        return std::make_unique<PigpiodBackend>(device);
+    }
+    if (type == "pigpiod_notify")
+    {
+        return std::make_unique<PigpiodNotifyBackend>(device);
+    }
+#endif
+#ifdef DIFFDRIVE_MINI_OCEBOT_WITH_PIGPIO
+    if (type == "pigpio")
+    {
+        return std::make_unique<PigpioBackend>();
+    }
+#endif
+#ifdef DIFFDRIVE_MINI_OCEBOT_WITH_LIBGPIOD
+    if (type == "libgpiod")
+    {
+        return device.empty() ? std::make_unique<LibgpiodBackend>() : std::make_unique<LibgpiodBackend>(device);
+    }
+#endif
+    return nullptr;
+}
+
+#endif
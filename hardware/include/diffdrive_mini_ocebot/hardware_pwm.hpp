@@ -0,0 +1,71 @@
+#ifndef DIFFDRIVE_MINI_OCEBOT_HARDWARE_PWM_HPP
+#define DIFFDRIVE_MINI_OCEBOT_HARDWARE_PWM_HPP
+
+#include <cstdint>
+
+// Bookkeeping for the two PWM peripheral channels of the Raspberry Pi, used
+// by the pigpio backends. GPIO 12 and 18 share channel 0 and GPIO 13 and 19
+// channel 1, so a channel goes to the first pin that claims it and any other
+// pin falls back to software PWM. Duties are kept in the pin's range and
+// scaled to pigpio's 0-1000000 hardware duty.
+struct HardwarePwmChannels
+{
+    static constexpr unsigned DEFAULT_FREQUENCY = 20000;
+    static constexpr uint32_t FULL_DUTY = 1000000;
+
+    int owner[2] = {-1, -1};
+    unsigned frequency[2] = {0, 0};
+    unsigned range[2] = {0, 0};
+    unsigned duty[2] = {0, 0};
+
+    static int channel_of(unsigned gpio)
+    {
+        switch (gpio)
+        {
+            case 12:
+            case 18:
+                return 0;
+            case 13:
+            case 19:
+                return 1;
+            default:
+                return -1;
+        }
+    }
+
+    // Returns the channel, or -1 if the pin has none or it is taken.
+    int claim(unsigned gpio, unsigned pin_frequency, unsigned pin_range)
+    {
+        int channel = channel_of(gpio);
+        if (channel < 0 || (owner[channel] >= 0 && owner[channel] != static_cast<int>(gpio)))
+        {
+            return -1;
+        }
+
+        owner[channel] = static_cast<int>(gpio);
+        frequency[channel] = pin_frequency > 0 ? pin_frequency : DEFAULT_FREQUENCY;
+        range[channel] = pin_range;
+        duty[channel] = 0;
+        return channel;
+    }
+
+    // Channel driven by the pin, or -1 for software PWM pins.
+    int find(unsigned gpio) const
+    {
+        int channel = channel_of(gpio);
+        return (channel >= 0 && owner[channel] == static_cast<int>(gpio)) ? channel : -1;
+    }
+
+    uint32_t scaled_duty(int channel) const
+    {
+        return static_cast<uint32_t>(static_cast<uint64_t>(duty[channel]) * FULL_DUTY / range[channel]);
+    }
+
+    void clear()
+    {
+        owner[0] = -1;
+        owner[1] = -1;
+    }
+};
+
+#endif
@@ -0,0 +1,143 @@
+#ifndef DIFFDRIVE_MINI_OCEBOT_LATENCY_HISTOGRAM_HPP
+#define DIFFDRIVE_MINI_OCEBOT_LATENCY_HISTOGRAM_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+// Lock-free HDR-style histogram of nanosecond durations. Values below 16 ns
+// get their own bucket; above that every power of two is split into 16
+// linear sub-buckets, so a bucket is never wider than 1/16 of its value
+// (~6% relative error). Recording is a single relaxed fetch_add and safe
+// from any number of threads; percentiles read while recording is going on
+// are approximate.
+class LatencyHistogram
+{
+    public:
+    static constexpr unsigned SUB_BUCKET_BITS = 4;
+    static constexpr unsigned SUB_BUCKETS = 1u << SUB_BUCKET_BITS;
+    static constexpr unsigned MAX_EXPONENT = 44;
+    static constexpr size_t BUCKETS = (MAX_EXPONENT - SUB_BUCKET_BITS + 1) * SUB_BUCKETS + SUB_BUCKETS;
+
+    LatencyHistogram() = default;
+    LatencyHistogram(const LatencyHistogram &) = delete;
+    LatencyHistogram &operator=(const LatencyHistogram &) = delete;
+
+    void record(uint64_t value_ns)
+    {
+        counts[bucket_index(value_ns)].fetch_add(1, std::memory_order_relaxed);
+        total.fetch_add(1, std::memory_order_relaxed);
+
+        uint64_t current = max.load(std::memory_order_relaxed);
+        while (value_ns > current && !max.compare_exchange_weak(current, value_ns, std::memory_order_relaxed))
+        {
+        }
+    }
+
+    void reset()
+    {
+        for (std::atomic<uint64_t> &count : counts)
+        {
+            count.store(0, std::memory_order_relaxed);
+        }
+        total.store(0, std::memory_order_relaxed);
+        max.store(0, std::memory_order_relaxed);
+    }
+
+    uint64_t count() const
+    {
+        return total.load(std::memory_order_relaxed);
+    }
+
+    uint64_t max_ns() const
+    {
+        return max.load(std::memory_order_relaxed);
+    }
+
+    // Upper bound of the bucket holding the given fraction (0..1) of samples,
+    // capped at the recorded maximum. Several quantiles are filled in one pass
+    // over the buckets; they must be sorted ascending.
+    void quantiles(const double *fractions, double *values_ns, size_t n) const
+    {
+        uint64_t samples = count();
+        uint64_t largest = max_ns();
+        size_t next = 0;
+        uint64_t seen = 0;
+
+        for (size_t bucket = 0; bucket < BUCKETS && next < n; bucket++)
+        {
+            seen += counts[bucket].load(std::memory_order_relaxed);
+            while (next < n && samples > 0 && seen >= fractions[next] * samples)
+            {
+                values_ns[next++] = static_cast<double>(std::min(bucket_upper_bound(bucket), largest));
+            }
+        }
+
+        for (; next < n; next++)
+        {
+            values_ns[next] = static_cast<double>(largest);
+        }
+    }
+
+    static size_t bucket_index(uint64_t value)
+    {
+        if (value < SUB_BUCKETS)
+        {
+            return static_cast<size_t>(value);
+        }
+
+        unsigned exponent = 63 - __builtin_clzll(value);
+        if (exponent > MAX_EXPONENT)
+        {
+            return BUCKETS - 1;
+        }
+
+        unsigned sub_bucket = (value >> (exponent - SUB_BUCKET_BITS)) & (SUB_BUCKETS - 1);
+        return (exponent - SUB_BUCKET_BITS + 1) * SUB_BUCKETS + sub_bucket;
+    }
+
+    static uint64_t bucket_upper_bound(size_t bucket)
+    {
+        if (bucket < SUB_BUCKETS)
+        {
+            return bucket;
+        }
+
+        unsigned exponent = static_cast<unsigned>(bucket / SUB_BUCKETS) + SUB_BUCKET_BITS - 1;
+        uint64_t sub_bucket = bucket % SUB_BUCKETS;
+        uint64_t width = uint64_t(1) << (exponent - SUB_BUCKET_BITS);
+        return (uint64_t(1) << exponent) + (sub_bucket + 1) * width - 1;
+    }
+
+    private:
+    std::atomic<uint64_t> counts[BUCKETS] = {};
+    std::atomic<uint64_t> total{0};
+    std::atomic<uint64_t> max{0};
+};
+
+// Records the lifetime of the scope into a histogram, if there is one.
+class ScopedLatency
+{
+    public:
+    explicit ScopedLatency(LatencyHistogram *target)
+        : histogram(target), start(target != nullptr ? std::chrono::steady_clock::now() : std::chrono::steady_clock::time_point())
+    {
+    }
+
+    ~ScopedLatency()
+    {
+        if (histogram != nullptr)
+        {
+            histogram->record(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - start).count());
+        }
+    }
+
+    private:
+    LatencyHistogram *histogram;
+    std::chrono::steady_clock::time_point start;
+};
+
+#endif
@@ -0,0 +1,53 @@
+#ifndef DIFFDRIVE_MINI_OCEBOT_LATEST_VALUE_SLOT_HPP
+#define DIFFDRIVE_MINI_OCEBOT_LATEST_VALUE_SLOT_HPP
+
+#include <atomic>
+
+// Single-producer/single-consumer mailbox that only keeps the newest value.
+// Implemented as a triple buffer: the producer fills its private buffer and
+// swaps it with the shared middle one, the consumer swaps its private buffer
+// with the middle one when it is marked fresh. Both sides are wait-free and
+// never block each other; values the consumer did not pick up in time are
+// overwritten.
+template <typename T>
+class LatestValueSlot
+{
+    public:
+    LatestValueSlot() = default;
+    LatestValueSlot(const LatestValueSlot &) = delete;
+    LatestValueSlot &operator=(const LatestValueSlot &) = delete;
+
+    // Producer side.
+    void publish(const T &value)
+    {
+        buffers[back] = value;
+        unsigned previous = middle.exchange(back | FRESH, std::memory_order_acq_rel);
+        back = previous & INDEX_MASK;
+    }
+
+    // Consumer side. Returns false when nothing new was published since the
+    // last call.
+    bool take(T &value)
+    {
+        if (!(middle.load(std::memory_order_acquire) & FRESH))
+        {
+            return false;
+        }
+
+        unsigned previous = middle.exchange(front, std::memory_order_acq_rel);
+        front = previous & INDEX_MASK;
+        value = buffers[front];
+        return true;
+    }
+
+    private:
+    static constexpr unsigned INDEX_MASK = 3;
+    static constexpr unsigned FRESH = 4;
+
+    alignas(64) T buffers[3] = {};
+    alignas(64) std::atomic<unsigned> middle{1};
+    alignas(64) unsigned back = 0;
+    alignas(64) unsigned front = 2;
+};
+
+#endif
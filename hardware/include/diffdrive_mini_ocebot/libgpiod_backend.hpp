@@ -0,0 +1,528 @@
+#ifndef DIFFDRIVE_MINI_OCEBOT_LIBGPIOD_BACKEND_HPP
+#define DIFFDRIVE_MINI_OCEBOT_LIBGPIOD_BACKEND_HPP
+
+#include <gpiod.h>
+#include <poll.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "diffdrive_mini_ocebot/gpio_backend.hpp"
+
+// Uses the Linux GPIO character device through libgpiod v2. The kernel has no
+// PWM on plain GPIO lines, so duty cycles are generated by a software PWM
+// thread.
+//
+// All lines with an edge callback share one line request, so the kernel
+// queues their events in a single FIFO in the order they happened (which the
+// quadrature decoder depends on) and timestamps them with CLOCK_MONOTONIC at
+// interrupt time. An edge thread drains up to EVENT_BATCH events per
+// gpiod_line_request_read_edge_events call; the tick passed to the callbacks
+// is that timestamp in microseconds. Changing the set of edge lines means
+// releasing and re-requesting that request, which drops the queued events,
+// so a batch of callback changes is applied with one request.
+//
+// Works on any board with a GPIO character device (including the Pi 5) and
+// against the gpio-sim kernel module, whose chip path goes in gpio_device.
+class LibgpiodBackend : public GpioBackend
+{
+    struct Line
+    {
+        gpiod_line_request *request = nullptr;
+        Mode mode = INPUT;
+        unsigned duty = 0;
+        unsigned range = PWM_RANGE;
+        GpioEdgeCallback callback = nullptr;
+        void *userdata = nullptr;
+    };
+
+    public:
+    static constexpr unsigned MAX_GPIO = 54;
+    static constexpr unsigned PWM_RANGE = 255;
+    static constexpr size_t EVENT_BATCH = 64;
+    static constexpr size_t KERNEL_EVENT_BUFFER = 1024;
+
+    std::string chip_path = "/dev/gpiochip0";
+    // Shared by every software PWM line.
+    std::atomic<unsigned> pwm_frequency{200};
+
+    LibgpiodBackend() = default;
+
+    explicit LibgpiodBackend(const std::string &chip) : chip_path(chip) {}
+
+    ~LibgpiodBackend() override
+    {
+        disconnect();
+    }
+
+    const char *name() const override
+    {
+        return "libgpiod";
+    }
+
+    bool connect() override
+    {
+        chip = gpiod_chip_open(chip_path.c_str());
+        if (chip == nullptr)
+        {
+            return false;
+        }
+
+        running = true;
+        pwm_thread = std::thread(&LibgpiodBackend::pwm_loop, this);
+        return true;
+    }
+
+    void disconnect() override
+    {
+        stop_edge_thread();
+        edge_batch = false;
+        cancelled_lines.clear();
+        running = false;
+        if (pwm_thread.joinable())
+        {
+            pwm_thread.join();
+        }
+
+        for (Line &line : lines)
+        {
+            if (line.request != nullptr && line.request != edge_request)
+            {
+                gpiod_line_request_release(line.request);
+            }
+            line = Line();
+        }
+        if (edge_request != nullptr)
+        {
+            gpiod_line_request_release(edge_request);
+            edge_request = nullptr;
+        }
+
+        if (chip != nullptr)
+        {
+            gpiod_chip_close(chip);
+            chip = nullptr;
+        }
+    }
+
+    int set_mode(unsigned gpio, Mode mode) override
+    {
+        if (gpio >= MAX_GPIO)
+        {
+            return -1;
+        }
+
+        std::lock_guard<std::mutex> lock(lines_mutex);
+        if (lines[gpio].callback != nullptr)
+        {
+            return mode == INPUT ? 0 : -1;
+        }
+        return request_line(gpio, mode);
+    }
+
+    int read(unsigned gpio) override
+    {
+        if (gpio >= MAX_GPIO)
+        {
+            return -1;
+        }
+
+        std::lock_guard<std::mutex> lock(lines_mutex);
+        if (lines[gpio].request == nullptr)
+        {
+            return -1;
+        }
+        return gpiod_line_request_get_value(lines[gpio].request, gpio);
+    }
+
+    int write(unsigned gpio, unsigned level) override
+    {
+        if (gpio >= MAX_GPIO)
+        {
+            return -1;
+        }
+
+        std::lock_guard<std::mutex> lock(lines_mutex);
+        if (lines[gpio].request == nullptr)
+        {
+            return -1;
+        }
+        lines[gpio].duty = level ? lines[gpio].range : 0;
+        return set_level(gpio, level);
+    }
+
+    // The PWM thread only toggles duties strictly between 0 and the range;
+    // the two ends are constant levels set here.
+    int set_pwm_dutycycle(unsigned gpio, unsigned duty) override
+    {
+        if (gpio >= MAX_GPIO)
+        {
+            return -1;
+        }
+
+        std::lock_guard<std::mutex> lock(lines_mutex);
+        Line &line = lines[gpio];
+        if (line.request == nullptr || duty > line.range)
+        {
+            return -1;
+        }
+        line.duty = duty;
+        if (line.mode == OUTPUT && (duty == 0 || duty == line.range))
+        {
+            return set_level(gpio, duty == 0 ? 0 : 1);
+        }
+        return 0;
+    }
+
+    int get_pwm_dutycycle(unsigned gpio) override
+    {
+        if (gpio >= MAX_GPIO)
+        {
+            return -1;
+        }
+
+        std::lock_guard<std::mutex> lock(lines_mutex);
+        return lines[gpio].duty;
+    }
+
+    // The character device has no PWM peripheral access, so every line uses
+    // the software PWM thread. Its resolution is limited by the sleep
+    // granularity, not by the range.
+    int configure_pwm(unsigned gpio, unsigned frequency, unsigned range, bool /* hardware */) override
+    {
+        if (gpio >= MAX_GPIO || range == 0)
+        {
+            return -1;
+        }
+
+        std::lock_guard<std::mutex> lock(lines_mutex);
+        if (frequency > 0)
+        {
+            pwm_frequency = frequency;
+        }
+        lines[gpio].range = range;
+        lines[gpio].duty = 0;
+        if (lines[gpio].request != nullptr && lines[gpio].mode == OUTPUT)
+        {
+            return set_level(gpio, 0);
+        }
+        return 0;
+    }
+
+    // Outside a batch, each call is a batch of its own.
+    int add_edge_callback(unsigned gpio, GpioEdgeCallback callback, void *userdata) override
+    {
+        if (gpio >= MAX_GPIO)
+        {
+            return -1;
+        }
+
+        const bool single = !edge_batch;
+        if (single)
+        {
+            begin_edge_changes();
+        }
+        {
+            std::lock_guard<std::mutex> lock(lines_mutex);
+            release_line(gpio);
+            lines[gpio].callback = callback;
+            lines[gpio].userdata = userdata;
+        }
+        const int result = single ? end_edge_changes() : 0;
+
+        return result < 0 ? result : static_cast<int>(gpio);
+    }
+
+    int cancel_edge_callback(int id) override
+    {
+        if (id < 0 || id >= static_cast<int>(MAX_GPIO))
+        {
+            return -1;
+        }
+
+        const bool single = !edge_batch;
+        if (single)
+        {
+            begin_edge_changes();
+        }
+        {
+            std::lock_guard<std::mutex> lock(lines_mutex);
+            lines[id].callback = nullptr;
+            lines[id].userdata = nullptr;
+            cancelled_lines.push_back(id);
+        }
+
+        return single ? end_edge_changes() : 0;
+    }
+
+    // The edge thread stays stopped until the batch ends, as the callbacks
+    // it reads change meanwhile.
+    void begin_edge_changes() override
+    {
+        stop_edge_thread();
+        edge_batch = true;
+    }
+
+    // Requests all edge lines at once, then gives the cancelled ones their
+    // own input request back.
+    int end_edge_changes() override
+    {
+        int result;
+        {
+            std::lock_guard<std::mutex> lock(lines_mutex);
+            result = request_edge_lines();
+            for (unsigned gpio : cancelled_lines)
+            {
+                if (result == 0 && lines[gpio].callback == nullptr)
+                {
+                    result = request_line(gpio, INPUT);
+                }
+            }
+            cancelled_lines.clear();
+        }
+        edge_batch = false;
+        start_edge_thread();
+
+        return result;
+    }
+
+    private:
+    gpiod_chip *chip = nullptr;
+    Line lines[MAX_GPIO];
+    gpiod_line_request *edge_request = nullptr;
+    std::mutex lines_mutex;
+    // Callback changes since begin_edge_changes; only touched by the thread
+    // making them.
+    bool edge_batch = false;
+    std::vector<unsigned> cancelled_lines;
+
+    std::atomic<bool> running{false};
+    std::atomic<bool> edges_running{false};
+    std::thread pwm_thread;
+    std::thread edge_thread;
+
+    // Drops the line's own request; lines in the shared edge request are
+    // left to request_edge_lines.
+    void release_line(unsigned gpio)
+    {
+        if (lines[gpio].request != nullptr && lines[gpio].request != edge_request)
+        {
+            gpiod_line_request_release(lines[gpio].request);
+        }
+        lines[gpio].request = nullptr;
+    }
+
+    int request_line(unsigned gpio, Mode mode)
+    {
+        if (chip == nullptr)
+        {
+            return -1;
+        }
+
+        release_line(gpio);
+
+        gpiod_line_settings *settings = gpiod_line_settings_new();
+        gpiod_line_config *line_config = gpiod_line_config_new();
+        gpiod_request_config *request_config = gpiod_request_config_new();
+
+        if (mode == OUTPUT)
+        {
+            gpiod_line_settings_set_direction(settings, GPIOD_LINE_DIRECTION_OUTPUT);
+            gpiod_line_settings_set_output_value(settings, GPIOD_LINE_VALUE_INACTIVE);
+        }
+        else
+        {
+            gpiod_line_settings_set_direction(settings, GPIOD_LINE_DIRECTION_INPUT);
+        }
+
+        gpiod_line_config_add_line_settings(line_config, &gpio, 1, settings);
+        gpiod_request_config_set_consumer(request_config, "diffdrive_mini_ocebot");
+
+        lines[gpio].request = gpiod_chip_request_lines(chip, request_config, line_config);
+        lines[gpio].mode = mode;
+        lines[gpio].duty = 0;
+
+        gpiod_request_config_free(request_config);
+        gpiod_line_config_free(line_config);
+        gpiod_line_settings_free(settings);
+
+        return lines[gpio].request == nullptr ? -1 : 0;
+    }
+
+    // Re-requests every line with a callback as one input request with both
+    // edges detected. Called with the edge thread stopped.
+    int request_edge_lines()
+    {
+        if (chip == nullptr)
+        {
+            return -1;
+        }
+
+        if (edge_request != nullptr)
+        {
+            for (Line &line : lines)
+            {
+                if (line.request == edge_request)
+                {
+                    line.request = nullptr;
+                }
+            }
+            gpiod_line_request_release(edge_request);
+            edge_request = nullptr;
+        }
+
+        std::vector<unsigned> offsets;
+        for (unsigned gpio = 0; gpio < MAX_GPIO; gpio++)
+        {
+            if (lines[gpio].callback != nullptr)
+            {
+                offsets.push_back(gpio);
+            }
+        }
+        if (offsets.empty())
+        {
+            return 0;
+        }
+
+        gpiod_line_settings *settings = gpiod_line_settings_new();
+        gpiod_line_config *line_config = gpiod_line_config_new();
+        gpiod_request_config *request_config = gpiod_request_config_new();
+
+        gpiod_line_settings_set_direction(settings, GPIOD_LINE_DIRECTION_INPUT);
+        gpiod_line_settings_set_edge_detection(settings, GPIOD_LINE_EDGE_BOTH);
+        gpiod_line_settings_set_event_clock(settings, GPIOD_LINE_CLOCK_MONOTONIC);
+
+        gpiod_line_config_add_line_settings(line_config, offsets.data(), offsets.size(), settings);
+        gpiod_request_config_set_consumer(request_config, "diffdrive_mini_ocebot");
+        gpiod_request_config_set_event_buffer_size(request_config, KERNEL_EVENT_BUFFER);
+
+        edge_request = gpiod_chip_request_lines(chip, request_config, line_config);
+
+        gpiod_request_config_free(request_config);
+        gpiod_line_config_free(line_config);
+        gpiod_line_settings_free(settings);
+
+        if (edge_request == nullptr)
+        {
+            return -1;
+        }
+
+        for (unsigned gpio : offsets)
+        {
+            lines[gpio].request = edge_request;
+            lines[gpio].mode = INPUT;
+            lines[gpio].duty = 0;
+        }
+        return 0;
+    }
+
+    int set_level(unsigned gpio, unsigned level)
+    {
+        return gpiod_line_request_set_value(
+            lines[gpio].request, gpio, level ? GPIOD_LINE_VALUE_ACTIVE : GPIOD_LINE_VALUE_INACTIVE);
+    }
+
+    // Each period raises every line with a duty between 0 and its range, then
+    // drops them in order of their off time.
+    void pwm_loop()
+    {
+        realtime.apply_to_current_thread("gpiod-pwm");
+
+        using clock = std::chrono::steady_clock;
+        std::vector<std::pair<clock::duration, unsigned>> active;
+        auto period_start = clock::now();
+
+        while (running)
+        {
+            const auto period = std::chrono::duration_cast<clock::duration>(
+                std::chrono::nanoseconds(1000000000 / pwm_frequency));
+
+            active.clear();
+            {
+                std::lock_guard<std::mutex> lock(lines_mutex);
+                for (unsigned gpio = 0; gpio < MAX_GPIO; gpio++)
+                {
+                    const Line &line = lines[gpio];
+                    if (line.mode == OUTPUT && line.duty > 0 && line.duty < line.range)
+                    {
+                        set_level(gpio, 1);
+                        active.emplace_back(period * line.duty / line.range, gpio);
+                    }
+                }
+            }
+            std::sort(active.begin(), active.end());
+
+            for (const auto &pin : active)
+            {
+                std::this_thread::sleep_until(period_start + pin.first);
+                std::lock_guard<std::mutex> lock(lines_mutex);
+                if (lines[pin.second].duty < lines[pin.second].range)
+                {
+                    set_level(pin.second, 0);
+                }
+            }
+
+            period_start += period;
+            std::this_thread::sleep_until(period_start);
+        }
+    }
+
+    void start_edge_thread()
+    {
+        edges_running = true;
+        edge_thread = std::thread(&LibgpiodBackend::edge_loop, this);
+    }
+
+    void stop_edge_thread()
+    {
+        edges_running = false;
+        if (edge_thread.joinable())
+        {
+            edge_thread.join();
+        }
+    }
+
+    void edge_loop()
+    {
+        realtime.apply_to_current_thread("gpiod-edge");
+
+        if (edge_request == nullptr)
+        {
+            return;
+        }
+
+        pollfd descriptor{gpiod_line_request_get_fd(edge_request), POLLIN, 0};
+        gpiod_edge_event_buffer *buffer = gpiod_edge_event_buffer_new(EVENT_BATCH);
+
+        while (edges_running)
+        {
+            if (poll(&descriptor, 1, 100) <= 0)
+            {
+                continue;
+            }
+
+            int count = gpiod_line_request_read_edge_events(edge_request, buffer, EVENT_BATCH);
+            for (int i = 0; i < count; i++)
+            {
+                gpiod_edge_event *event = gpiod_edge_event_buffer_get_event(buffer, i);
+                unsigned gpio = gpiod_edge_event_get_line_offset(event);
+                if (gpio >= MAX_GPIO || lines[gpio].callback == nullptr)
+                {
+                    continue;
+                }
+
+                unsigned level = gpiod_edge_event_get_event_type(event) == GPIOD_EDGE_EVENT_RISING_EDGE;
+                uint32_t tick = static_cast<uint32_t>(gpiod_edge_event_get_timestamp_ns(event) / 1000);
+                lines[gpio].callback(gpio, level, tick, lines[gpio].userdata);
+            }
+        }
+
+        gpiod_edge_event_buffer_free(buffer);
+    }
+};
+
+#endif
@@ -0,0 +1,151 @@
+#ifndef DIFFDRIVE_MINI_OCEBOT_PIGPIO_BACKEND_HPP
+#define DIFFDRIVE_MINI_OCEBOT_PIGPIO_BACKEND_HPP
+
+#include <pigpio.h>
+#include <atomic>
+
+#include "diffdrive_mini_ocebot/gpio_backend.hpp"
+#include "diffdrive_mini_ocebot/hardware_pwm.hpp"
+
+// Links the pigpio C library into the process and drives the peripherals
+// directly, without a daemon in between. Needs root and must not run
+// alongside pigpiod.
+//
+// Edges arrive on the alert thread gpioInitialise starts. pigpio does not
+// hand it out, so realtime is applied to it from its first alert.
+class PigpioBackend : public GpioBackend
+{
+    struct Registration
+    {
+        GpioEdgeCallback callback = nullptr;
+        void *userdata = nullptr;
+        PigpioBackend *backend = nullptr;
+    };
+
+    public:
+    static constexpr unsigned MAX_GPIO = 54;
+
+    bool initialised = false;
+
+    PigpioBackend() = default;
+
+    ~PigpioBackend() override
+    {
+        disconnect();
+    }
+
+    const char *name() const override
+    {
+        return "pigpio";
+    }
+
+    bool connect() override
+    {
+        alert_thread_configured = false;
+        initialised = gpioInitialise() >= 0;
+        return initialised;
+    }
+
+    void disconnect() override
+    {
+        if (initialised)
+        {
+            gpioTerminate();
+            initialised = false;
+        }
+        hardware_pwm.clear();
+    }
+
+    int set_mode(unsigned gpio, Mode mode) override
+    {
+        return gpioSetMode(gpio, mode == OUTPUT ? PI_OUTPUT : PI_INPUT);
+    }
+
+    int read(unsigned gpio) override
+    {
+        return gpioRead(gpio);
+    }
+
+    int write(unsigned gpio, unsigned level) override
+    {
+        return gpioWrite(gpio, level);
+    }
+
+    int set_pwm_dutycycle(unsigned gpio, unsigned duty) override
+    {
+        int channel = hardware_pwm.find(gpio);
+        if (channel < 0)
+        {
+            return gpioPWM(gpio, duty);
+        }
+
+        if (duty > hardware_pwm.range[channel])
+        {
+            return -1;
+        }
+        hardware_pwm.duty[channel] = duty;
+        return gpioHardwarePWM(gpio, hardware_pwm.frequency[channel], hardware_pwm.scaled_duty(channel));
+    }
+
+    int get_pwm_dutycycle(unsigned gpio) override
+    {
+        int channel = hardware_pwm.find(gpio);
+        return channel < 0 ? gpioGetPWMdutycycle(gpio) : static_cast<int>(hardware_pwm.duty[channel]);
+    }
+
+    int configure_pwm(unsigned gpio, unsigned frequency, unsigned range, bool hardware) override
+    {
+        if (hardware && hardware_pwm.claim(gpio, frequency, range) >= 0)
+        {
+            return set_pwm_dutycycle(gpio, 0) < 0 ? -1 : 1;
+        }
+
+        if (frequency > 0 && gpioSetPWMfrequency(gpio, frequency) < 0)
+        {
+            return -1;
+        }
+        return gpioSetPWMrange(gpio, range) < 0 ? -1 : 0;
+    }
+
+    // pigpio allows a single alert function per gpio, so the gpio doubles as the id.
+    int add_edge_callback(unsigned gpio, GpioEdgeCallback callback, void *userdata) override
+    {
+        if (gpio >= MAX_GPIO)
+        {
+            return -1;
+        }
+
+        registrations[gpio] = {callback, userdata, this};
+        int result = gpioSetAlertFuncEx(gpio, dispatch, &registrations[gpio]);
+        return result < 0 ? result : static_cast<int>(gpio);
+    }
+
+    int cancel_edge_callback(int id) override
+    {
+        if (id < 0 || id >= static_cast<int>(MAX_GPIO))
+        {
+            return -1;
+        }
+
+        return gpioSetAlertFuncEx(id, NULL, NULL);
+    }
+
+    private:
+    Registration registrations[MAX_GPIO];
+    HardwarePwmChannels hardware_pwm;
+    std::atomic<bool> alert_thread_configured{false};
+
+    static void dispatch(int gpio, int level, uint32_t tick, void *userdata)
+    {
+        Registration *registration = static_cast<Registration *>(userdata);
+        PigpioBackend *backend = registration->backend;
+        if (!backend->alert_thread_configured.load(std::memory_order_relaxed) &&
+            !backend->alert_thread_configured.exchange(true) && backend->realtime.enabled())
+        {
+            backend->realtime.apply_to_current_thread("pigpio-alert");
+        }
+        registration->callback(gpio, level, tick, registration->userdata);
+    }
+};
+
+#endif
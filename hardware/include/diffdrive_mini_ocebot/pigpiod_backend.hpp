@@ -0,0 +1,166 @@
+#ifndef DIFFDRIVE_MINI_OCEBOT_PIGPIOD_BACKEND_HPP
+#define DIFFDRIVE_MINI_OCEBOT_PIGPIOD_BACKEND_HPP
+
+#include <pigpiod_if2.h>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "diffdrive_mini_ocebot/gpio_backend.hpp"
+#include "diffdrive_mini_ocebot/hardware_pwm.hpp"
+#include "diffdrive_mini_ocebot/pigpiod_session.hpp"
+
+// Talks to a running pigpiod over its socket interface. Every call is a
+// round trip to the daemon. The connection is a PigpiodSession shared with
+// the other pigpiod backends in the process, so each backend only keeps
+// track of the pins it watches and the PWM channels it claimed.
+class PigpiodBackend : public GpioBackend
+{
+    public:
+    int pi = -1;
+    std::string host = "";
+    std::shared_ptr<PigpiodSession> session;
+
+    PigpiodBackend() = default;
+
+    explicit PigpiodBackend(const std::string &daemon_host) : host(daemon_host) {}
+
+    ~PigpiodBackend() override
+    {
+        disconnect();
+    }
+
+    const char *name() const override
+    {
+        return "pigpiod";
+    }
+
+    bool connect() override
+    {
+        session = PigpiodSession::acquire(host);
+        pi = session ? session->pi : -1;
+        return pi >= 0;
+    }
+
+    // Gives back what this backend holds on the session; the connection
+    // itself stops with the last backend.
+    void disconnect() override
+    {
+        if (session)
+        {
+            for (unsigned gpio = 0; gpio < PigpiodSession::MAX_GPIO; gpio++)
+            {
+                if (watched & (1u << gpio))
+                {
+                    session->unwatch(static_cast<int>(gpio));
+                }
+            }
+            for (int channel = 0; channel < 2; channel++)
+            {
+                if (hardware_pwm.owner[channel] >= 0)
+                {
+                    session->release_pwm_channel(channel, static_cast<unsigned>(hardware_pwm.owner[channel]));
+                }
+            }
+        }
+        watched = 0;
+        hardware_pwm.clear();
+        session.reset();
+        pi = -1;
+    }
+
+    int set_mode(unsigned gpio, Mode mode) override
+    {
+        return ::set_mode(pi, gpio, mode == OUTPUT ? PI_OUTPUT : PI_INPUT);
+    }
+
+    int read(unsigned gpio) override
+    {
+        return gpio_read(pi, gpio);
+    }
+
+    int write(unsigned gpio, unsigned level) override
+    {
+        return gpio_write(pi, gpio, level);
+    }
+
+    int set_pwm_dutycycle(unsigned gpio, unsigned duty) override
+    {
+        int channel = hardware_pwm.find(gpio);
+        if (channel < 0)
+        {
+            return set_PWM_dutycycle(pi, gpio, duty);
+        }
+
+        if (duty > hardware_pwm.range[channel])
+        {
+            return -1;
+        }
+        hardware_pwm.duty[channel] = duty;
+        return hardware_PWM(pi, gpio, hardware_pwm.frequency[channel], hardware_pwm.scaled_duty(channel));
+    }
+
+    int get_pwm_dutycycle(unsigned gpio) override
+    {
+        int channel = hardware_pwm.find(gpio);
+        return channel < 0 ? get_PWM_dutycycle(pi, gpio) : static_cast<int>(hardware_pwm.duty[channel]);
+    }
+
+    // Software PWM frequencies snap to the nearest one pigpiod supports at
+    // its sample rate.
+    int configure_pwm(unsigned gpio, unsigned frequency, unsigned range, bool hardware) override
+    {
+        const int channel = HardwarePwmChannels::channel_of(gpio);
+        if (hardware && channel >= 0 && session->claim_pwm_channel(channel, gpio))
+        {
+            if (hardware_pwm.claim(gpio, frequency, range) >= 0)
+            {
+                return set_pwm_dutycycle(gpio, 0) < 0 ? -1 : 1;
+            }
+            session->release_pwm_channel(channel, gpio);
+        }
+
+        if (frequency > 0 && set_PWM_frequency(pi, gpio, frequency) < 0)
+        {
+            return -1;
+        }
+        return set_PWM_range(pi, gpio, range) < 0 ? -1 : 0;
+    }
+
+    int add_edge_callback(unsigned gpio, GpioEdgeCallback callback, void *userdata) override
+    {
+        return watch(gpio, PigpiodSession::CALLBACK_EX, callback, userdata);
+    }
+
+    int cancel_edge_callback(int id) override
+    {
+        if (!session || id < 0 || id >= static_cast<int>(PigpiodSession::MAX_GPIO) || !(watched & (1u << id)))
+        {
+            return -1;
+        }
+        watched &= ~(1u << id);
+        return session->unwatch(id);
+    }
+
+    protected:
+    int watch(unsigned gpio, PigpiodSession::Delivery delivery, GpioEdgeCallback callback, void *userdata)
+    {
+        if (!session)
+        {
+            return -1;
+        }
+        int id = session->watch(gpio, delivery, callback, userdata, realtime);
+        if (id >= 0)
+        {
+            watched |= 1u << id;
+        }
+        return id;
+    }
+
+    private:
+    // Pins this backend watches on the session.
+    uint32_t watched = 0;
+    HardwarePwmChannels hardware_pwm;
+};
+
+#endif
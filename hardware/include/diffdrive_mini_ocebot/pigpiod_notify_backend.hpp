@@ -0,0 +1,39 @@
+#ifndef DIFFDRIVE_MINI_OCEBOT_PIGPIOD_NOTIFY_BACKEND_HPP
+#define DIFFDRIVE_MINI_OCEBOT_PIGPIOD_NOTIFY_BACKEND_HPP
+
+#include <string>
+
+#include "diffdrive_mini_ocebot/pigpiod_backend.hpp"
+
+// PigpiodBackend that receives edges through a pigpio notification pipe
+// (notify_open/notify_begin) instead of one callback_ex per pin. pigpiod
+// writes a gpioReport_t with the whole bank 1 level mask every time a
+// watched pin changes; a reader thread pulls them out of /dev/pigpio<handle>
+// hundreds at a time and turns level differences into callbacks, so a busy
+// encoder costs one read() per batch rather than one wakeup per edge. The
+// pipe and reader belong to the PigpiodSession and serve every notify
+// backend on it.
+//
+// The pipe lives on the daemon's machine, so this only works with a local
+// pigpiod, and only GPIO 0-31 can be watched.
+class PigpiodNotifyBackend : public PigpiodBackend
+{
+    public:
+    static constexpr unsigned MAX_GPIO = PigpiodSession::MAX_GPIO;
+
+    PigpiodNotifyBackend() = default;
+
+    explicit PigpiodNotifyBackend(const std::string &daemon_host) : PigpiodBackend(daemon_host) {}
+
+    const char *name() const override
+    {
+        return "pigpiod_notify";
+    }
+
+    int add_edge_callback(unsigned gpio, GpioEdgeCallback callback, void *userdata) override
+    {
+        return watch(gpio, PigpiodSession::NOTIFY, callback, userdata);
+    }
+};
+
+#endif
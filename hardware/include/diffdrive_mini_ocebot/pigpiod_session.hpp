@@ -0,0 +1,504 @@
+#ifndef DIFFDRIVE_MINI_OCEBOT_PIGPIOD_SESSION_HPP
+#define DIFFDRIVE_MINI_OCEBOT_PIGPIOD_SESSION_HPP
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <pigpiod_if2.h>
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "diffdrive_mini_ocebot/gpio_backend.hpp"
+#include "diffdrive_mini_ocebot/realtime.hpp"
+
+// One pigpiod connection shared by every pigpiod backend in the process
+// that talks to the same daemon. Each pigpio_start opens a command socket,
+// a notification socket and a callback thread, so the drive, a gripper and
+// a pan-tilt on one Pi would otherwise hold three of each. acquire() hands
+// out the live session for a daemon or starts one; the connection stops when
+// the last shared_ptr to it is dropped. Sessions are keyed by the resolved
+// address and port, so "", "localhost:8888" and "127.0.0.1" share one.
+//
+// Edges are routed by pin. Each watched pin has one route to the callback
+// of the backend that registered it, and a pin belongs to one backend at a
+// time. Pins watched through notifications share one notification pipe and
+// reader thread. The two PWM peripheral channels are claimed here as well,
+// since every backend on the daemon drives the same ones.
+//
+// The session owns the threads edges arrive on: the pigpiod_if2 callback
+// thread its pigpio_start created and the notification reader. They serve
+// every backend on the session, so the realtime settings of the first watch
+// that has any apply to them. pigpiod_if2 does not hand out its thread, so
+// that one is configured from its first callback.
+//
+// pigpiod only reports edges on GPIO 0-31, and the notification pipe lives
+// on the daemon's machine, so NOTIFY needs a local pigpiod.
+class PigpiodSession
+{
+    public:
+    enum Delivery
+    {
+        // One callback_ex per pin, dispatched by the pigpiod_if2 thread.
+        CALLBACK_EX = 0,
+        // Level reports in batches through the notification pipe.
+        NOTIFY = 1
+    };
+
+    static constexpr unsigned MAX_GPIO = 32;
+    static constexpr size_t REPORTS_PER_READ = 256;
+
+    const std::string host;
+    const int pi;
+
+    PigpiodSession(const PigpiodSession &) = delete;
+    PigpiodSession &operator=(const PigpiodSession &) = delete;
+
+    ~PigpiodSession()
+    {
+        close_notify();
+        for (unsigned gpio = 0; gpio < MAX_GPIO; gpio++)
+        {
+            if (routes[gpio].callback_id >= 0)
+            {
+                callback_cancel(routes[gpio].callback_id);
+            }
+        }
+        if (pi >= 0)
+        {
+            pigpio_stop(pi);
+        }
+    }
+
+    // The session for the daemon at host (see start()), or nullptr if it
+    // cannot be reached. The name lookup and pigpio_start can block for
+    // seconds, so neither runs under the registry lock: connecting only
+    // holds up other acquire() calls for the same daemon.
+    static std::shared_ptr<PigpiodSession> acquire(const std::string &daemon_host)
+    {
+        const std::string key = daemon_key(daemon_host);
+        std::shared_ptr<std::mutex> connecting;
+        {
+            std::lock_guard<std::mutex> lock(registry_mutex());
+            RegistryEntry &entry = registry()[key];
+            std::shared_ptr<PigpiodSession> session = entry.session.lock();
+            if (session)
+            {
+                return session;
+            }
+            if (!entry.connecting)
+            {
+                entry.connecting = std::make_shared<std::mutex>();
+            }
+            connecting = entry.connecting;
+        }
+
+        std::lock_guard<std::mutex> connect_lock(*connecting);
+        {
+            // Started by the acquire() this one waited for.
+            std::lock_guard<std::mutex> lock(registry_mutex());
+            std::shared_ptr<PigpiodSession> session = registry()[key].session.lock();
+            if (session)
+            {
+                return session;
+            }
+        }
+
+        std::shared_ptr<PigpiodSession> session(new PigpiodSession(daemon_host));
+        if (session->pi < 0)
+        {
+            return nullptr;
+        }
+        std::lock_guard<std::mutex> lock(registry_mutex());
+        registry()[key].session = session;
+        return session;
+    }
+
+    // Live sessions in the process, for diagnostics.
+    static size_t count()
+    {
+        std::lock_guard<std::mutex> lock(registry_mutex());
+        size_t live = 0;
+        for (const auto &entry : registry())
+        {
+            live += entry.second.session.expired() ? 0 : 1;
+        }
+        return live;
+    }
+
+    // Routes the edges of gpio to callback. Returns gpio as the id for
+    // unwatch(), or -1 if the pin is out of range, already watched or
+    // refused by the daemon. realtime applies to the notification reader
+    // when this starts it.
+    int watch(unsigned gpio, Delivery delivery, GpioEdgeCallback callback, void *userdata, const RealtimeConfig &realtime)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (gpio >= MAX_GPIO || routes[gpio].callback.load(std::memory_order_relaxed) != nullptr)
+        {
+            return -1;
+        }
+
+        if (delivery == CALLBACK_EX && realtime.enabled() && !callback_realtime_set.load(std::memory_order_relaxed))
+        {
+            callback_realtime = realtime;
+            callback_realtime_set.store(true, std::memory_order_release);
+        }
+
+        Route &route = routes[gpio];
+        route.session = this;
+        route.userdata.store(userdata, std::memory_order_relaxed);
+        route.callback.store(callback, std::memory_order_release);
+        route.delivery = delivery;
+
+        bool watching = false;
+        if (delivery == CALLBACK_EX)
+        {
+            route.callback_id = callback_ex(pi, gpio, EITHER_EDGE, dispatch_callback, &route);
+            watching = route.callback_id >= 0;
+        }
+        else if (handle >= 0 || open_notify(realtime))
+        {
+            const uint32_t bits = notified.load(std::memory_order_relaxed) | (1u << gpio);
+            notified.store(bits, std::memory_order_release);
+            watching = notify_begin(pi, handle, bits) >= 0;
+        }
+
+        if (!watching)
+        {
+            release(gpio);
+            return -1;
+        }
+        return static_cast<int>(gpio);
+    }
+
+    int unwatch(int id)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (id < 0 || id >= static_cast<int>(MAX_GPIO) || routes[id].callback.load(std::memory_order_relaxed) == nullptr)
+        {
+            return -1;
+        }
+        return release(static_cast<unsigned>(id));
+    }
+
+    // Claims the PWM peripheral channel for gpio across all backends on the
+    // daemon. True if the channel is free or already the pin's.
+    bool claim_pwm_channel(int channel, unsigned gpio)
+    {
+        int owner = -1;
+        return pwm_owner[channel].compare_exchange_strong(owner, static_cast<int>(gpio)) ||
+            owner == static_cast<int>(gpio);
+    }
+
+    void release_pwm_channel(int channel, unsigned gpio)
+    {
+        int owner = static_cast<int>(gpio);
+        pwm_owner[channel].compare_exchange_strong(owner, -1);
+    }
+
+    private:
+    struct Route
+    {
+        std::atomic<GpioEdgeCallback> callback{nullptr};
+        std::atomic<void *> userdata{nullptr};
+        Delivery delivery = CALLBACK_EX;
+        int callback_id = -1;
+        PigpiodSession *session = nullptr;
+    };
+
+    std::mutex mutex;
+    Route routes[MAX_GPIO];
+    std::atomic<int> pwm_owner[2] = {{-1}, {-1}};
+
+    // Realtime settings for the pigpiod_if2 callback thread.
+    RealtimeConfig callback_realtime;
+    std::atomic<bool> callback_realtime_set{false};
+    std::atomic<bool> callback_thread_configured{false};
+
+    // Notification pipe, opened by the first NOTIFY watch.
+    std::atomic<uint32_t> notified{0};
+    int handle = -1;
+    int pipe_fd = -1;
+    std::atomic<bool> reading{false};
+    std::thread reader;
+
+    explicit PigpiodSession(const std::string &daemon_host) : host(daemon_host), pi(start(daemon_host))
+    {
+    }
+
+    // host or host:port; empty parts keep the pigpio defaults (PIGPIO_ADDR
+    // and PIGPIO_PORT, else localhost:8888).
+    static int start(const std::string &daemon_host)
+    {
+        std::string address;
+        std::string port;
+        split_host(daemon_host, address, port);
+        return pigpio_start(address.empty() ? NULL : address.c_str(), port.empty() ? NULL : port.c_str());
+    }
+
+    // More than one colon is taken as an IPv6 address without port.
+    static void split_host(const std::string &daemon_host, std::string &address, std::string &port)
+    {
+        const size_t colon = daemon_host.rfind(':');
+        if (colon == std::string::npos || daemon_host.find(':') != colon)
+        {
+            address = daemon_host;
+            port.clear();
+            return;
+        }
+        address = daemon_host.substr(0, colon);
+        port = daemon_host.substr(colon + 1);
+    }
+
+    // The daemon pigpio_start would reach for daemon_host, as numeric
+    // address:port with the pigpio defaults applied. Every loopback address
+    // is the local daemon. A host that does not resolve keeps its name.
+    static std::string daemon_key(const std::string &daemon_host)
+    {
+        std::string address;
+        std::string port;
+        split_host(daemon_host, address, port);
+        if (address.empty())
+        {
+            const char *env = std::getenv("PIGPIO_ADDR");
+            address = env != nullptr && *env != '\0' ? env : "localhost";
+        }
+        if (port.empty())
+        {
+            const char *env = std::getenv("PIGPIO_PORT");
+            port = env != nullptr && *env != '\0' ? env : "8888";
+        }
+        if (std::all_of(port.begin(), port.end(), [](unsigned char c) {return std::isdigit(c) != 0;}))
+        {
+            port = std::to_string(std::strtol(port.c_str(), nullptr, 10));
+        }
+
+        addrinfo hints{};
+        hints.ai_socktype = SOCK_STREAM;
+        addrinfo *found = nullptr;
+        if (getaddrinfo(address.c_str(), NULL, &hints, &found) == 0 && found != nullptr)
+        {
+            char numeric[NI_MAXHOST];
+            if (is_loopback(found->ai_addr))
+            {
+                address = "localhost";
+            }
+            else if (getnameinfo(found->ai_addr, found->ai_addrlen, numeric, sizeof(numeric), NULL, 0, NI_NUMERICHOST) == 0)
+            {
+                address = numeric;
+            }
+            freeaddrinfo(found);
+        }
+        return address + ":" + port;
+    }
+
+    static bool is_loopback(const sockaddr *address)
+    {
+        if (address->sa_family == AF_INET)
+        {
+            const uint32_t ip = ntohl(reinterpret_cast<const sockaddr_in *>(address)->sin_addr.s_addr);
+            return (ip >> 24) == 127;
+        }
+        if (address->sa_family == AF_INET6)
+        {
+            return IN6_IS_ADDR_LOOPBACK(&reinterpret_cast<const sockaddr_in6 *>(address)->sin6_addr);
+        }
+        return false;
+    }
+
+    // The live session of a daemon, and the lock that lets one acquire() at
+    // a time connect to it.
+    struct RegistryEntry
+    {
+        std::weak_ptr<PigpiodSession> session;
+        std::shared_ptr<std::mutex> connecting;
+    };
+
+    static std::map<std::string, RegistryEntry> &registry()
+    {
+        static std::map<std::string, RegistryEntry> sessions;
+        return sessions;
+    }
+
+    static std::mutex &registry_mutex()
+    {
+        static std::mutex registry_lock;
+        return registry_lock;
+    }
+
+    // Stops the delivery of gpio, then drops its route. Called with the
+    // mutex held.
+    int release(unsigned gpio)
+    {
+        Route &route = routes[gpio];
+        int result = 0;
+        if (route.delivery == CALLBACK_EX)
+        {
+            if (route.callback_id >= 0)
+            {
+                result = callback_cancel(route.callback_id);
+                route.callback_id = -1;
+            }
+        }
+        else
+        {
+            const uint32_t bits = notified.load(std::memory_order_relaxed) & ~(1u << gpio);
+            notified.store(bits, std::memory_order_release);
+            if (handle >= 0)
+            {
+                result = bits == 0 ? notify_pause(pi, handle) : notify_begin(pi, handle, bits);
+            }
+        }
+        route.callback.store(nullptr, std::memory_order_release);
+        return result;
+    }
+
+    static void dispatch_callback(int /* pi */, unsigned gpio, unsigned level, uint32_t tick, void *userdata)
+    {
+        const Route &route = *static_cast<Route *>(userdata);
+        route.session->configure_callback_thread();
+        deliver(route, gpio, level, tick);
+    }
+
+    void configure_callback_thread()
+    {
+        if (!callback_thread_configured.load(std::memory_order_relaxed) &&
+            callback_realtime_set.load(std::memory_order_acquire) && !callback_thread_configured.exchange(true))
+        {
+            callback_realtime.apply_to_current_thread("pigpiod-callback");
+        }
+    }
+
+    // An edge that races with unwatch() finds no callback and is dropped.
+    static void deliver(const Route &route, unsigned gpio, unsigned level, uint32_t tick)
+    {
+        GpioEdgeCallback callback = route.callback.load(std::memory_order_acquire);
+        if (callback != nullptr)
+        {
+            callback(gpio, level, tick, route.userdata.load(std::memory_order_relaxed));
+        }
+    }
+
+    bool open_notify(const RealtimeConfig &realtime)
+    {
+        handle = notify_open(pi);
+        if (handle < 0)
+        {
+            return false;
+        }
+
+        char path[32];
+        std::snprintf(path, sizeof(path), "/dev/pigpio%d", handle);
+        pipe_fd = ::open(path, O_RDONLY | O_NONBLOCK);
+        if (pipe_fd < 0)
+        {
+            notify_close(pi, handle);
+            handle = -1;
+            return false;
+        }
+
+        reading = true;
+        reader = std::thread(&PigpiodSession::read_loop, this, read_bank_1(pi), realtime);
+        return true;
+    }
+
+    void close_notify()
+    {
+        reading = false;
+        if (reader.joinable())
+        {
+            reader.join();
+        }
+        if (handle >= 0)
+        {
+            notify_close(pi, handle);
+            handle = -1;
+        }
+        if (pipe_fd >= 0)
+        {
+            ::close(pipe_fd);
+            pipe_fd = -1;
+        }
+        notified = 0;
+    }
+
+    // pigpiod writes a gpioReport_t with the whole bank 1 level mask every
+    // time a watched pin changes. They are read hundreds at a time and level
+    // differences become callbacks, so a busy encoder costs one read() per
+    // batch rather than one wakeup per edge.
+    void read_loop(uint32_t levels, RealtimeConfig realtime)
+    {
+        realtime.apply_to_current_thread("pigpiod-notify");
+
+        gpioReport_t reports[REPORTS_PER_READ];
+        size_t buffered = 0;
+
+        while (reading)
+        {
+            unsigned char *buffer = reinterpret_cast<unsigned char *>(reports);
+            ssize_t bytes = ::read(pipe_fd, buffer + buffered, sizeof(reports) - buffered);
+            if (bytes <= 0)
+            {
+                if (bytes < 0 && errno != EAGAIN && errno != EINTR)
+                {
+                    break;
+                }
+                // Nothing queued (or no writer yet): wait, but wake up
+                // periodically to notice a stop request.
+                pollfd descriptor{pipe_fd, POLLIN, 0};
+                poll(&descriptor, 1, 100);
+                continue;
+            }
+
+            buffered += static_cast<size_t>(bytes);
+            size_t complete = buffered / sizeof(gpioReport_t);
+            levels = dispatch_reports(reports, complete, levels);
+
+            // Keep a partial report for the next read.
+            size_t used = complete * sizeof(gpioReport_t);
+            buffered -= used;
+            std::memmove(buffer, buffer + used, buffered);
+        }
+    }
+
+    uint32_t dispatch_reports(const gpioReport_t *reports, size_t count, uint32_t levels)
+    {
+        uint32_t bits = notified.load(std::memory_order_acquire);
+
+        for (size_t i = 0; i < count; i++)
+        {
+            // Watchdog, keep-alive and event reports carry no new levels.
+            if (reports[i].flags != 0)
+            {
+                continue;
+            }
+
+            uint32_t changed = (reports[i].level ^ levels) & bits;
+            levels = reports[i].level;
+
+            while (changed != 0)
+            {
+                unsigned gpio = static_cast<unsigned>(__builtin_ctz(changed));
+                changed &= changed - 1;
+                deliver(routes[gpio], gpio, (levels >> gpio) & 1, reports[i].tick);
+            }
+        }
+
+        return levels;
+    }
+};
+
+#endif
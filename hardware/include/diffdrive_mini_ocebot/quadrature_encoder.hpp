@@ -0,0 +1,87 @@
+#ifndef DIFFDRIVE_MINI_OCEBOT_QUADRATURE_ENCODER_HPP
+#define DIFFDRIVE_MINI_OCEBOT_QUADRATURE_ENCODER_HPP
+
+#include <atomic>
+#include <cstdint>
+
+#include "diffdrive_mini_ocebot/edge_timestamp_ring.hpp"
+#include "diffdrive_mini_ocebot/encoder_counter.hpp"
+#include "diffdrive_mini_ocebot/event_log.hpp"
+#include "diffdrive_mini_ocebot/latency_histogram.hpp"
+
+// 4x quadrature decoder for one wheel. The state is (A << 1) | B, and every
+// edge on either channel looks up (previous << 2) | current in a transition
+// table: +1 / -1 for a valid Gray-code step. A callback only reports the
+// level of the channel that fired, so a missed edge shows up as a callback
+// whose level equals the stored level of that channel. It is counted as an
+// error and leaves the count alone: the missed edge and the reported one
+// cancel out.
+//
+// Without a B pin every A edge counts +1, as the single-channel encoders
+// always did. Every counted edge is also pushed with its tick into the
+// wheel's edge ring for velocity estimation.
+class QuadratureEncoder
+{
+    public:
+    int a_pin = -1;
+    int b_pin = -1;
+    unsigned state = 0;
+    EncoderCounter *count = nullptr;
+    EncoderEdgeRing *edges = nullptr;
+    // Callback durations are recorded here when set.
+    LatencyHistogram *callback_latency = nullptr;
+    // Every edge is appended here when set.
+    EventLog *event_log = nullptr;
+    std::atomic<unsigned> errors{0};
+
+    QuadratureEncoder() = default;
+
+    void setup(int a, int b, EncoderCounter &counter, EncoderEdgeRing &edge_ring, unsigned a_level, unsigned b_level)
+    {
+        a_pin = a;
+        b_pin = b;
+        count = &counter;
+        edges = &edge_ring;
+        errors = 0;
+        state = ((a_level & 1) << 1) | (b_level & 1);
+    }
+
+    void update(unsigned gpio, unsigned level, uint32_t tick)
+    {
+        // pigpio reports watchdog timeouts as level 2.
+        if (level > 1)
+        {
+            return;
+        }
+
+        if (b_pin < 0)
+        {
+            count->add(1);
+            edges->push(tick, 1);
+            return;
+        }
+
+        unsigned next = (static_cast<int>(gpio) == a_pin) ? ((state & 1) | (level << 1)) : ((state & 2) | level);
+        if (next == state)
+        {
+            errors.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+
+        int8_t step = TRANSITIONS[(state << 2) | next];
+        state = next;
+        count->add(step);
+        edges->push(tick, step);
+    }
+
+    private:
+    // Only one channel changes per callback, so the entries where both bits
+    // differ (or none) are never looked up.
+    static constexpr int8_t TRANSITIONS[16] = {
+        0, +1, -1, 0,
+        -1, 0, 0, +1,
+        +1, 0, 0, -1,
+        0, -1, +1, 0};
+};
+
+#endif
@@ -0,0 +1,109 @@
+#ifndef DIFFDRIVE_MINI_OCEBOT_REALTIME_HPP
+#define DIFFDRIVE_MINI_OCEBOT_REALTIME_HPP
+
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <cerrno>
+#include <cstddef>
+#include <cstring>
+
+#include "rclcpp/rclcpp.hpp"
+
+// Scheduling settings for every thread the plugin creates or receives
+// callbacks on. A priority of 0 keeps the default scheduler and a cpu of -1
+// leaves the affinity alone. Failures (usually missing CAP_SYS_NICE or
+// rtprio/memlock limits) are logged and the thread keeps running with the
+// default settings.
+struct RealtimeConfig
+{
+    static constexpr size_t STACK_PREFAULT_BYTES = 64 * 1024;
+
+    int priority = 0;
+    int cpu = -1;
+    bool lock_memory = false;
+
+    bool enabled() const
+    {
+        return priority > 0 || cpu >= 0 || lock_memory;
+    }
+
+    // Returns false if any of the requested settings could not be applied.
+    bool apply_to_current_thread(const char *thread_name) const
+    {
+        pthread_setname_np(pthread_self(), thread_name);
+        bool ok = true;
+
+        if (priority > 0)
+        {
+            sched_param param{};
+            param.sched_priority = priority;
+            int result = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+            if (result != 0)
+            {
+                RCLCPP_WARN(
+                    rclcpp::get_logger("DiffBotSystemHardware"),
+                    "Thread '%s': could not set SCHED_FIFO priority %d (%s). Grant CAP_SYS_NICE or raise "
+                    "rtprio in /etc/security/limits.conf; running with the default scheduler.",
+                    thread_name, priority, std::strerror(result));
+                ok = false;
+            }
+        }
+
+        if (cpu >= 0)
+        {
+            cpu_set_t cpus;
+            CPU_ZERO(&cpus);
+            CPU_SET(cpu, &cpus);
+            int result = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+            if (result != 0)
+            {
+                RCLCPP_WARN(
+                    rclcpp::get_logger("DiffBotSystemHardware"),
+                    "Thread '%s': could not pin to CPU %d (%s); running unpinned.",
+                    thread_name, cpu, std::strerror(result));
+                ok = false;
+            }
+        }
+
+        if (lock_memory)
+        {
+            prefault_stack();
+        }
+
+        return ok;
+    }
+
+    // Locks current and future pages so page faults cannot stall the
+    // control threads. Process-wide; call once.
+    bool lock_process_memory() const
+    {
+        if (!lock_memory)
+        {
+            return true;
+        }
+
+        if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0)
+        {
+            RCLCPP_WARN(
+                rclcpp::get_logger("DiffBotSystemHardware"),
+                "Could not lock process memory (%s). Grant CAP_IPC_LOCK or raise memlock in "
+                "/etc/security/limits.conf; page faults may stall the control threads.",
+                std::strerror(errno));
+            return false;
+        }
+
+        return true;
+    }
+
+    private:
+    static void prefault_stack()
+    {
+        unsigned char stack[STACK_PREFAULT_BYTES];
+        std::memset(stack, 0, sizeof(stack));
+        // Keeps the compiler from dropping the otherwise dead stores.
+        asm volatile("" : : "r"(stack) : "memory");
+    }
+};
+
+#endif
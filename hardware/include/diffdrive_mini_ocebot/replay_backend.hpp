@@ -0,0 +1,188 @@
+#ifndef DIFFDRIVE_MINI_OCEBOT_REPLAY_BACKEND_HPP
+#define DIFFDRIVE_MINI_OCEBOT_REPLAY_BACKEND_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "diffdrive_mini_ocebot/event_log.hpp"
+#include "diffdrive_mini_ocebot/sim_backend.hpp"
+
+// SimBackend that plays back an EventLog recorded on the robot. Recorded
+// edges go through the normal callback path with their original ticks, so
+// the decoders and velocity estimators see exactly what they saw in the
+// field. Recorded outputs are not applied to the pins; they are kept in
+// recorded_duty/recorded_level for comparison with what the plugin writes
+// during the replay.
+//
+// With time_scale > 0 a thread replays against the wall clock (1 = real
+// time, 10 = ten times faster). With time_scale <= 0 nothing runs on its
+// own and the caller steps the replay with advance(), which makes a replay
+// driven from read() fully deterministic.
+class ReplayBackend : public SimBackend
+{
+    public:
+    double time_scale = 1.0;
+    std::atomic<unsigned> recorded_duty[MAX_GPIO] = {};
+    std::atomic<unsigned> recorded_level[MAX_GPIO] = {};
+
+    explicit ReplayBackend(const std::string &log_path) : path(log_path)
+    {
+    }
+
+    ~ReplayBackend() override
+    {
+        stop();
+    }
+
+    const char *name() const override
+    {
+        return "replay";
+    }
+
+    bool connect() override
+    {
+        EventLog log;
+        if (!log.open(path))
+        {
+            return false;
+        }
+
+        std::lock_guard<std::mutex> lock(replay_mutex);
+        events.clear();
+        events.reserve(log.size());
+        for (uint64_t i = 0; i < log.size(); i++)
+        {
+            events.push_back(log.at(i));
+        }
+
+        // Appends from several threads can land slightly out of order.
+        std::stable_sort(events.begin(), events.end(), [](const EventRecord &a, const EventRecord &b) {
+            return a.stamp_ns < b.stamp_ns;
+        });
+
+        SimBackend::connect();
+
+        // Every activation records the input levels it read before its
+        // first edge. Playback starts from the first ones per pin; later
+        // ones reset the pin when playback reaches them.
+        bool seeded[MAX_GPIO] = {};
+        for (const EventRecord &event : events)
+        {
+            if (event.type == EventRecord::INPUT_LEVEL && event.pin < MAX_GPIO && !seeded[event.pin])
+            {
+                seeded[event.pin] = true;
+                pins[event.pin].level = event.value;
+            }
+        }
+
+        next_event = 0;
+        replay_time = 0;
+        start_ns = events.empty() ? 0 : events.front().stamp_ns;
+
+        if (time_scale > 0)
+        {
+            running = true;
+            replay_thread = std::thread(&ReplayBackend::replay_loop, this);
+        }
+        return true;
+    }
+
+    void disconnect() override
+    {
+        stop();
+        SimBackend::disconnect();
+    }
+
+    // Delivers every event recorded within the next seconds of log time.
+    void advance(double seconds) override
+    {
+        std::lock_guard<std::mutex> lock(replay_mutex);
+        replay_time += seconds;
+        uint64_t until_ns = start_ns + static_cast<uint64_t>(replay_time * 1e9);
+
+        while (next_event < events.size() && events[next_event].stamp_ns <= until_ns)
+        {
+            deliver(events[next_event++]);
+        }
+    }
+
+    bool finished() const
+    {
+        return next_event >= events.size();
+    }
+
+    size_t event_count() const
+    {
+        return events.size();
+    }
+
+    private:
+    std::string path;
+    std::vector<EventRecord> events;
+    std::atomic<size_t> next_event{0};
+    uint64_t start_ns = 0;
+    double replay_time = 0;
+    std::mutex replay_mutex;
+    std::atomic<bool> running{false};
+    std::thread replay_thread;
+
+    void stop()
+    {
+        running = false;
+        if (replay_thread.joinable())
+        {
+            replay_thread.join();
+        }
+    }
+
+    void replay_loop()
+    {
+        realtime.apply_to_current_thread("replay");
+
+        const double step = 1e-3;
+        const auto wall_step = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+            std::chrono::duration<double>(step / time_scale));
+        auto next_step = std::chrono::steady_clock::now();
+
+        while (running && !finished())
+        {
+            advance(step);
+            next_step += wall_step;
+            std::this_thread::sleep_until(next_step);
+        }
+    }
+
+    void deliver(const EventRecord &event)
+    {
+        if (event.pin >= MAX_GPIO)
+        {
+            return;
+        }
+
+        switch (event.type)
+        {
+            case EventRecord::EDGE:
+                inject_edge(event.pin, event.value, event.tick);
+                break;
+            case EventRecord::WRITE:
+                recorded_level[event.pin] = event.value;
+                break;
+            case EventRecord::PWM:
+                recorded_duty[event.pin] = event.value;
+                break;
+            case EventRecord::INPUT_LEVEL:
+                pins[event.pin].level = event.value;
+                break;
+            default:
+                break;
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,179 @@
+#ifndef DIFFDRIVE_MINI_OCEBOT_SIM_BACKEND_HPP
+#define DIFFDRIVE_MINI_OCEBOT_SIM_BACKEND_HPP
+
+#include <atomic>
+#include <cstdint>
+
+#include "diffdrive_mini_ocebot/gpio_backend.hpp"
+
+// Pure in-memory GPIO. Output calls only update the pin table, and edges are
+// produced by calling inject_edge, which runs the registered callback on the
+// caller's thread. Lets the plugin run without any GPIO hardware. Levels,
+// duty cycles and callbacks are atomic so a simulation thread can read what
+// the Controller writes and callbacks can come and go while it runs.
+class SimBackend : public GpioBackend
+{
+    public:
+    static constexpr unsigned MAX_GPIO = 54;
+
+    struct Pin
+    {
+        Mode mode = INPUT;
+        std::atomic<unsigned> level{0};
+        std::atomic<unsigned> duty{0};
+        std::atomic<unsigned> range{255};
+        std::atomic<GpioEdgeCallback> callback{nullptr};
+        std::atomic<void *> userdata{nullptr};
+
+        void reset()
+        {
+            mode = INPUT;
+            level = 0;
+            duty = 0;
+            range = 255;
+            callback = nullptr;
+            userdata = nullptr;
+        }
+    };
+
+    bool connected = false;
+    Pin pins[MAX_GPIO];
+
+    SimBackend() = default;
+
+    const char *name() const override
+    {
+        return "sim";
+    }
+
+    bool connect() override
+    {
+        connected = true;
+        return true;
+    }
+
+    void disconnect() override
+    {
+        connected = false;
+        for (Pin &pin : pins)
+        {
+            pin.reset();
+        }
+    }
+
+    int set_mode(unsigned gpio, Mode mode) override
+    {
+        if (gpio >= MAX_GPIO)
+        {
+            return -1;
+        }
+
+        pins[gpio].mode = mode;
+        return 0;
+    }
+
+    int read(unsigned gpio) override
+    {
+        if (gpio >= MAX_GPIO)
+        {
+            return -1;
+        }
+
+        return pins[gpio].level;
+    }
+
+    int write(unsigned gpio, unsigned level) override
+    {
+        if (gpio >= MAX_GPIO)
+        {
+            return -1;
+        }
+
+        pins[gpio].level = level ? 1 : 0;
+        pins[gpio].duty = level ? pins[gpio].range.load() : 0;
+        return 0;
+    }
+
+    int set_pwm_dutycycle(unsigned gpio, unsigned duty) override
+    {
+        if (gpio >= MAX_GPIO || duty > pins[gpio].range)
+        {
+            return -1;
+        }
+
+        pins[gpio].duty = duty;
+        return 0;
+    }
+
+    int get_pwm_dutycycle(unsigned gpio) override
+    {
+        if (gpio >= MAX_GPIO)
+        {
+            return -1;
+        }
+
+        return pins[gpio].duty;
+    }
+
+    // There is no PWM peripheral to simulate, so every pin is software PWM.
+    int configure_pwm(unsigned gpio, unsigned /* frequency */, unsigned range, bool /* hardware */) override
+    {
+        if (gpio >= MAX_GPIO || range == 0)
+        {
+            return -1;
+        }
+
+        pins[gpio].range = range;
+        pins[gpio].duty = 0;
+        return 0;
+    }
+
+    int add_edge_callback(unsigned gpio, GpioEdgeCallback callback, void *userdata) override
+    {
+        if (gpio >= MAX_GPIO)
+        {
+            return -1;
+        }
+
+        pins[gpio].userdata.store(userdata, std::memory_order_relaxed);
+        pins[gpio].callback.store(callback, std::memory_order_release);
+        return static_cast<int>(gpio);
+    }
+
+    int cancel_edge_callback(int id) override
+    {
+        if (id < 0 || id >= static_cast<int>(MAX_GPIO))
+        {
+            return -1;
+        }
+
+        // userdata stays, an edge that already loaded the callback may still
+        // use it.
+        pins[id].callback.store(nullptr, std::memory_order_release);
+        return 0;
+    }
+
+    // Simulated backends with their own notion of time step it here. With
+    // sim_time_scale <= 0 the plugin calls this from read() with the period.
+    virtual void advance(double seconds)
+    {
+        (void)seconds;
+    }
+
+    void inject_edge(unsigned gpio, unsigned level, uint32_t tick)
+    {
+        if (gpio >= MAX_GPIO)
+        {
+            return;
+        }
+
+        pins[gpio].level = level;
+        GpioEdgeCallback callback = pins[gpio].callback.load(std::memory_order_acquire);
+        if (callback != nullptr)
+        {
+            callback(gpio, level, tick, pins[gpio].userdata.load(std::memory_order_relaxed));
+        }
+    }
+};
+
+#endif
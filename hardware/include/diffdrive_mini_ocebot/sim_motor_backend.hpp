@@ -0,0 +1,200 @@
+#ifndef DIFFDRIVE_MINI_OCEBOT_SIM_MOTOR_BACKEND_HPP
+#define DIFFDRIVE_MINI_OCEBOT_SIM_MOTOR_BACKEND_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "diffdrive_mini_ocebot/sim_backend.hpp"
+
+// One simulated gearmotor with an encoder. The motor is first order: the
+// wheel speed approaches gain * effective duty with time_constant, where
+// duties below deadband do not move it (static friction). The encoder is a
+// two-channel quadrature disc with cycles_per_rev cycles on channel A; when
+// b_pin is -1 only the A edges are delivered.
+struct SimMotor
+{
+    int pwm_pin = -1;
+    int direction_pin = -1;
+    int a_pin = -1;
+    int b_pin = -1;
+    // Direction pin level that drives the wheel backwards.
+    unsigned reverse_level = 1;
+    double cycles_per_rev = 1820;
+    double gain = 20;
+    double time_constant = 0.05;
+    double deadband = 0.1;
+
+    double velocity = 0;
+    double angle = 0;
+    int64_t quarter = 0;
+};
+
+// SimBackend with DC motor plants behind the motor pins. Each step reads
+// the PWM duty and direction pin of every motor, integrates the plant and
+// injects the resulting encoder edges, with ticks interpolated to the
+// moment each edge happened, through the normal callback path.
+//
+// With time_scale > 0 a thread steps the plant against the wall clock
+// (1 = real time, 10 = ten times faster). With time_scale <= 0 nothing runs
+// on its own and the caller drives the simulation with advance().
+class SimMotorBackend : public SimBackend
+{
+    public:
+    double step_size = 100e-6;
+    double time_scale = 1.0;
+
+    SimMotorBackend() = default;
+
+    ~SimMotorBackend() override
+    {
+        stop();
+    }
+
+    const char *name() const override
+    {
+        return "sim_motor";
+    }
+
+    void add_motor(const SimMotor &motor)
+    {
+        std::lock_guard<std::mutex> lock(plant_mutex);
+        motors.push_back(motor);
+    }
+
+    bool connect() override
+    {
+        SimBackend::connect();
+        if (time_scale > 0)
+        {
+            running = true;
+            plant_thread = std::thread(&SimMotorBackend::plant_loop, this);
+        }
+        return true;
+    }
+
+    void disconnect() override
+    {
+        stop();
+        SimBackend::disconnect();
+    }
+
+    // Advances the simulation by the given simulated time.
+    void advance(double seconds) override
+    {
+        std::lock_guard<std::mutex> lock(plant_mutex);
+        while (seconds > 0)
+        {
+            double dt = std::min(step_size, seconds);
+            step(dt);
+            seconds -= dt;
+        }
+    }
+
+    double simulated_time() const
+    {
+        return sim_time;
+    }
+
+    // Wheel angle and speed of a motor in rad and rad/s, for checking
+    // estimates against the ground truth.
+    void motor_state(size_t index, double &angle, double &velocity)
+    {
+        std::lock_guard<std::mutex> lock(plant_mutex);
+        angle = motors[index].angle;
+        velocity = motors[index].velocity;
+    }
+
+    private:
+    // Channel levels (A << 1) | B for each quarter cycle, in forward order.
+    static constexpr unsigned GRAY[4] = {0, 1, 3, 2};
+
+    std::vector<SimMotor> motors;
+    std::mutex plant_mutex;
+    double sim_time = 0;
+    std::atomic<bool> running{false};
+    std::thread plant_thread;
+
+    void stop()
+    {
+        running = false;
+        if (plant_thread.joinable())
+        {
+            plant_thread.join();
+        }
+    }
+
+    void plant_loop()
+    {
+        realtime.apply_to_current_thread("sim-plant");
+
+        const auto wall_step = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+            std::chrono::duration<double>(step_size / time_scale));
+        auto next_step = std::chrono::steady_clock::now();
+
+        while (running)
+        {
+            advance(step_size);
+            next_step += wall_step;
+            std::this_thread::sleep_until(next_step);
+        }
+    }
+
+    void step(double dt)
+    {
+        double start_time = sim_time;
+        sim_time += dt;
+
+        for (SimMotor &motor : motors)
+        {
+            double duty = static_cast<double>(pins[motor.pwm_pin].duty) / pins[motor.pwm_pin].range;
+            double sign = (pins[motor.direction_pin].level == motor.reverse_level) ? -1.0 : 1.0;
+            double effective = duty > motor.deadband ? (duty - motor.deadband) / (1.0 - motor.deadband) : 0.0;
+            double target = sign * motor.gain * effective;
+
+            double start_velocity = motor.velocity;
+            motor.velocity += (target - motor.velocity) * (1.0 - std::exp(-dt / motor.time_constant));
+
+            double start_angle = motor.angle;
+            motor.angle += 0.5 * (start_velocity + motor.velocity) * dt;
+
+            emit_edges(motor, start_angle, start_time, dt);
+        }
+    }
+
+    void emit_edges(SimMotor &motor, double start_angle, double start_time, double dt)
+    {
+        double quarters_per_rad = motor.cycles_per_rev * 4 / (2 * M_PI);
+        double start_position = start_angle * quarters_per_rad;
+        double end_position = motor.angle * quarters_per_rad;
+        int64_t target = static_cast<int64_t>(std::floor(end_position));
+
+        while (motor.quarter != target)
+        {
+            int64_t next = motor.quarter + (target > motor.quarter ? 1 : -1);
+            double boundary = static_cast<double>(target > motor.quarter ? next : motor.quarter);
+            double fraction = (boundary - start_position) / (end_position - start_position);
+            uint32_t tick = static_cast<uint32_t>(static_cast<uint64_t>((start_time + fraction * dt) * 1e6));
+
+            unsigned before = GRAY[((motor.quarter % 4) + 4) % 4];
+            unsigned after = GRAY[((next % 4) + 4) % 4];
+            motor.quarter = next;
+
+            if ((before ^ after) & 2)
+            {
+                inject_edge(motor.a_pin, (after >> 1) & 1, tick);
+            }
+            else if (motor.b_pin >= 0)
+            {
+                inject_edge(motor.b_pin, after & 1, tick);
+            }
+        }
+    }
+};
+
+#endif
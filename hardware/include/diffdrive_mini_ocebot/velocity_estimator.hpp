@@ -0,0 +1,129 @@
+#ifndef DIFFDRIVE_MINI_OCEBOT_VELOCITY_ESTIMATOR_HPP
+#define DIFFDRIVE_MINI_OCEBOT_VELOCITY_ESTIMATOR_HPP
+
+#include <cmath>
+#include <cstdint>
+
+#include "diffdrive_mini_ocebot/edge_timestamp_ring.hpp"
+
+// M/T hybrid wheel velocity estimator fed from the edge timestamp ring.
+//
+// With many edges per sample (>= edge_threshold) the count over the sample
+// period is accurate enough (M method). With few edges the counts are divided
+// by the time between edges instead (T method), which is exact to the GPIO
+// tick and does not quantise at low speed. Without any edge the speed can at
+// most be one count over the time since the last edge, so the estimate decays
+// towards that bound and drops to zero after timeout seconds.
+class VelocityEstimator
+{
+    public:
+    double rads_per_count = 0;
+    unsigned edge_threshold = 10;
+    double timeout = 0.5;
+
+    double velocity = 0;
+
+    VelocityEstimator() = default;
+
+    void setup(double rads, unsigned threshold, double timeout_seconds)
+    {
+        rads_per_count = rads;
+        edge_threshold = threshold;
+        timeout = timeout_seconds;
+        reset();
+    }
+
+    void reset()
+    {
+        velocity = 0;
+        idle_time = 0;
+        have_reference = false;
+    }
+
+    template <size_t Capacity>
+    double update(EdgeTimestampRing<Capacity> &edges, double period)
+    {
+        return update(edges, period, [](const EncoderEdge &) {});
+    }
+
+    // Same, also handing every edge taken from the ring to on_edge.
+    template <size_t Capacity, typename EdgeSink>
+    double update(EdgeTimestampRing<Capacity> &edges, double period, EdgeSink &&on_edge)
+    {
+        EncoderEdge edge;
+        int64_t steps = 0;
+        unsigned count = 0;
+        uint32_t first_tick = 0;
+        uint32_t last_tick = 0;
+        int32_t first_step = 0;
+
+        while (edges.pop(edge))
+        {
+            on_edge(edge);
+            if (count == 0)
+            {
+                first_tick = edge.tick;
+                first_step = edge.step;
+            }
+            steps += edge.step;
+            count++;
+            last_tick = edge.tick;
+        }
+
+        if (count == 0)
+        {
+            idle_time += period;
+            have_reference = have_reference && idle_time < timeout;
+            if (!have_reference)
+            {
+                velocity = 0;
+            }
+            else if (std::fabs(velocity) * idle_time > rads_per_count)
+            {
+                velocity = std::copysign(rads_per_count / idle_time, velocity);
+            }
+            return velocity;
+        }
+
+        // The previous edge is a valid start of the interval as long as it is
+        // not older than the timeout.
+        bool recent_reference = have_reference;
+        uint32_t reference_tick = previous_tick;
+        previous_tick = last_tick;
+        have_reference = true;
+        idle_time = 0;
+
+        if (count >= edge_threshold)
+        {
+            velocity = steps * rads_per_count / period;
+            return velocity;
+        }
+
+        if (recent_reference)
+        {
+            return from_span(steps, last_tick - reference_tick, period);
+        }
+
+        if (count > 1)
+        {
+            return from_span(steps - first_step, last_tick - first_tick, period);
+        }
+
+        velocity = steps * rads_per_count / period;
+        return velocity;
+    }
+
+    private:
+    double idle_time = 0;
+    bool have_reference = false;
+    uint32_t previous_tick = 0;
+
+    // Unsigned tick differences survive the 32-bit microsecond wrap.
+    double from_span(int64_t steps, uint32_t span_us, double period)
+    {
+        velocity = span_us == 0 ? steps * rads_per_count / period : steps * rads_per_count / (span_us * 1e-6);
+        return velocity;
+    }
+};
+
+#endif
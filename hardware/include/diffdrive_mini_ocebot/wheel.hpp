@@ -3,35 +3,174 @@
 
 #include <string>
 #include <cmath>
+#include <cstddef>
+#include <memory>
+#include <vector>
 
-class Wheel
+#include "diffdrive_mini_ocebot/edge_odometry.hpp"
+#include "diffdrive_mini_ocebot/edge_timestamp_ring.hpp"
+#include "diffdrive_mini_ocebot/encoder_counter.hpp"
+#include "diffdrive_mini_ocebot/velocity_estimator.hpp"
+
+// State of all wheels as structure of arrays: one contiguous array per
+// field, indexed like the joints, so read()/write() run tight loops over
+// cmd, pos and vel. The encoder counters are one cache line each and sit
+// in their own array, away from the fields read() writes.
+class WheelArray
 {
     public:
-    
-    std::string name = "";
-    int enc = 0;
-    double cmd = 0;
-    double pos = 0;
-    double vel = 0;
-    double rads_per_count = 0;
 
-    Wheel() = default;
+    std::vector<std::string> names;
+    std::unique_ptr<EncoderCounter[]> counts;
+    std::unique_ptr<EncoderEdgeRing[]> edges;
+    std::vector<VelocityEstimator> estimators;
+    std::vector<double> cmd;
+    std::vector<double> pos;
+    std::vector<double> vel;
+    std::vector<double> rads_per_count;
+    // When not empty, every edge taken from a ring is also copied to the
+    // wheel's track for the odometry.
+    std::vector<EdgeTrack> tracks;
+    // Set while the velocity comes from the counters: the rings keep filling
+    // meanwhile and are dropped before the next edge-based sample.
+    std::vector<bool> stale_edges;
+
+    WheelArray() = default;
+
+    WheelArray(const std::vector<std::string> &wheel_names, const std::vector<unsigned> &counts_per_rev)
+    {
+        setup(wheel_names, counts_per_rev);
+    }
+
+    void setup(const std::vector<std::string> &wheel_names, const std::vector<unsigned> &counts_per_rev)
+    {
+        const size_t n = wheel_names.size();
+        names = wheel_names;
+        counts.reset(new EncoderCounter[n]);
+        edges.reset(new EncoderEdgeRing[n]);
+        estimators.assign(n, VelocityEstimator());
+        cmd.assign(n, 0.0);
+        pos.assign(n, 0.0);
+        vel.assign(n, 0.0);
+        stale_edges.assign(n, false);
+        rads_per_count.resize(n);
+        for (size_t i = 0; i < n; i++)
+        {
+            rads_per_count[i] = (2*M_PI)/counts_per_rev[i];
+        }
+        tracks.clear();
+    }
+
+    size_t size() const
+    {
+        return names.size();
+    }
+
+    void enable_tracks()
+    {
+        tracks.assign(size(), EdgeTrack());
+    }
+
+    // Back to a standing start at angle zero. Only while no encoder callback
+    // is registered, the edge rings are cleared from the consumer side.
+    void reset()
+    {
+        for (size_t i = 0; i < size(); i++)
+        {
+            counts[i].reset();
+            edges[i].clear();
+            estimators[i].reset();
+            stale_edges[i] = false;
+            cmd[i] = 0;
+            pos[i] = 0;
+            vel[i] = 0;
+        }
+        for (EdgeTrack &track : tracks)
+        {
+            track.count = 0;
+        }
+    }
+
+    double calc_enc_angle(size_t i) const
+    {
+        return counts[i].snapshot() * rads_per_count[i];
+    }
+
+    // The velocity either comes from the edge timestamps or, as before, from
+    // the position difference over the period.
+    double sample_velocity(size_t i, double new_pos, double pos_prev, double period, bool edge_velocity)
+    {
+        if (stale_edges[i])
+        {
+            discard_edges(i);
+        }
+        if (edge_velocity && !tracks.empty())
+        {
+            EdgeTrack &track = tracks[i];
+            return estimators[i].update(edges[i], period, [&track](const EncoderEdge &edge) { track.add(edge); });
+        }
+        if (edge_velocity)
+        {
+            return estimators[i].update(edges[i], period);
+        }
+
+        if (!tracks.empty())
+        {
+            EncoderEdge edge;
+            while (edges[i].pop(edge))
+            {
+                tracks[i].add(edge);
+            }
+        }
+        else
+        {
+            edges[i].clear();
+        }
+        return (new_pos - pos_prev) / period;
+    }
+
+    // Position difference without touching the edge ring, for while another
+    // thread consumes it or nobody does. The estimator starts over once edges
+    // are back, from an empty ring.
+    double counter_velocity(size_t i, double new_pos, double pos_prev, double period)
+    {
+        estimators[i].reset();
+        stale_edges[i] = true;
+        return (new_pos - pos_prev) / period;
+    }
 
-    Wheel(const std::string &wheel_name, int counts_per_rev)
+    // Drops the edges queued for wheel i, so they reach neither the velocity
+    // estimator nor the odometry. Consumer side, like sample_velocity.
+    void discard_edges(size_t i)
     {
-        setup(wheel_name, counts_per_rev);    
+        edges[i].clear();
+        estimators[i].reset();
+        if (!tracks.empty())
+        {
+            tracks[i].count = 0;
+        }
+        stale_edges[i] = false;
     }
 
-    void setup(const std::string &wheel_name, int counts_per_rev)
+    void update(double period, bool edge_velocity)
     {
-        name = wheel_name;
-        rads_per_count = (2*M_PI)/counts_per_rev;
+        for (size_t i = 0; i < size(); i++)
+        {
+            double pos_prev = pos[i];
+            pos[i] = calc_enc_angle(i);
+            vel[i] = sample_velocity(i, pos[i], pos_prev, period, edge_velocity);
+        }
     }
 
-    double calc_enc_angle()
+    void update_from_counter(double period)
     {
-        return enc * rads_per_count;
+        for (size_t i = 0; i < size(); i++)
+        {
+            double pos_prev = pos[i];
+            pos[i] = calc_enc_angle(i);
+            vel[i] = counter_velocity(i, pos[i], pos_prev, period);
+        }
     }
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,87 @@
+#ifndef DIFFDRIVE_MINI_OCEBOT_WHEEL_PID_HPP
+#define DIFFDRIVE_MINI_OCEBOT_WHEEL_PID_HPP
+
+#include <algorithm>
+#include <cmath>
+
+// Velocity PID for one wheel. Output is a signed duty in the same units as
+// Controller::set_motor_values. The feedforward term kff * setpoint is the
+// open-loop path (kff = 10 reproduces it), plus friction_duty in the
+// direction of the setpoint for motors that only start turning above some
+// duty. The PID only corrects the rest.
+// compute_with_feedforward takes the feedforward duty from elsewhere, such
+// as a measured duty/velocity table.
+//
+// The derivative acts on the measurement so setpoint steps do not kick, and
+// the integrator stops growing while the output is saturated in the
+// direction of the error (conditional integration) and is clamped to
+// +-i_clamp.
+class WheelPid
+{
+    public:
+    double kp = 0;
+    double ki = 0;
+    double kd = 0;
+    double kff = 10;
+    double friction_duty = 0;
+    double i_clamp = 50;
+    double output_limit = 115;
+
+    WheelPid() = default;
+
+    void setup(double p, double i, double d, double ff, double friction, double integral_clamp, double limit)
+    {
+        kp = p;
+        ki = i;
+        kd = d;
+        kff = ff;
+        friction_duty = friction;
+        i_clamp = integral_clamp;
+        output_limit = limit;
+        reset();
+    }
+
+    void reset()
+    {
+        integral = 0;
+        previous_measurement = 0;
+        have_previous = false;
+    }
+
+    double compute(double setpoint, double measurement, double dt)
+    {
+        const double direction = (setpoint > 0) - (setpoint < 0);
+        return compute_with_feedforward(kff * setpoint + direction * friction_duty, setpoint, measurement, dt);
+    }
+
+    double compute_with_feedforward(double feedforward, double setpoint, double measurement, double dt)
+    {
+        if (dt <= 0)
+        {
+            return std::clamp(feedforward + integral, -output_limit, output_limit);
+        }
+
+        double error = setpoint - measurement;
+        double derivative = have_previous ? -(measurement - previous_measurement) / dt : 0.0;
+        previous_measurement = measurement;
+        have_previous = true;
+
+        double unclamped = feedforward + kp * error + integral + kd * derivative;
+        double output = std::clamp(unclamped, -output_limit, output_limit);
+
+        bool saturated_with_error = (unclamped != output) && ((unclamped > 0) == (error > 0));
+        if (!saturated_with_error)
+        {
+            integral = std::clamp(integral + ki * error * dt, -i_clamp, i_clamp);
+        }
+
+        return output;
+    }
+
+    private:
+    double integral = 0;
+    double previous_measurement = 0;
+    bool have_previous = false;
+};
+
+#endif
@@ -0,0 +1,221 @@
+// Stress tests for the state shared between the GPIO callback threads and
+// read()/write(): the encoder counters, the quadrature decoder feeding them
+// and the latest-value slot that carries motor commands to the I/O thread.
+// Writers and readers run on separate threads, the checks look for lost
+// counts and torn values.
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+#include "diffdrive_mini_ocebot/encoder_counter.hpp"
+#include "diffdrive_mini_ocebot/latest_value_slot.hpp"
+#include "diffdrive_mini_ocebot/quadrature_encoder.hpp"
+
+namespace
+{
+constexpr int kWriters = 4;
+constexpr int64_t kEdgesPerWriter = 1000000;
+
+// Snapshots the counters until done, checking that none goes backwards or
+// leaves [low, high]. Returns the number of bad snapshots.
+int64_t watch_counters(
+  const EncoderCounter * counters, size_t count, const std::atomic<bool> & done, int64_t low, int64_t high)
+{
+  int64_t bad = 0;
+  std::vector<int64_t> previous(count, low);
+  while (!done.load(std::memory_order_acquire))
+  {
+    for (size_t i = 0; i < count; i++)
+    {
+      const int64_t value = counters[i].snapshot();
+      bad += value < previous[i] || value > high;
+      previous[i] = value;
+    }
+  }
+  return bad;
+}
+
+// kWriters threads add kEdgesPerWriter single counts each while another
+// thread watches the counter. Returns the number of bad snapshots.
+int64_t count_concurrently(EncoderCounter & counter, int64_t start)
+{
+  std::atomic<bool> done{false};
+  int64_t bad_snapshots = 0;
+  std::thread reader(
+    [&]() {bad_snapshots = watch_counters(&counter, 1, done, start, start + kWriters * kEdgesPerWriter);});
+
+  std::vector<std::thread> writers;
+  for (int w = 0; w < kWriters; w++)
+  {
+    writers.emplace_back(
+      [&counter]() {
+        for (int64_t i = 0; i < kEdgesPerWriter; i++)
+        {
+          counter.add(1);
+        }
+      });
+  }
+  for (std::thread & writer : writers)
+  {
+    writer.join();
+  }
+  done = true;
+  reader.join();
+  return bad_snapshots;
+}
+}  // namespace
+
+TEST(EncoderCounter, ConcurrentWritersLoseNoCounts)
+{
+  EncoderCounter counter;
+  EXPECT_EQ(count_concurrently(counter, 0), 0);
+  EXPECT_EQ(counter.snapshot(), kWriters * kEdgesPerWriter);
+}
+
+TEST(EncoderCounter, SnapshotsAreNotTornAcrossThe32BitBoundary)
+{
+  // Counting through 2^32 changes both halves of the value at once, so a
+  // torn read would show up as a jump outside the range.
+  const int64_t start = (int64_t{1} << 32) - kEdgesPerWriter;
+  EncoderCounter counter;
+  counter.add(start);
+  EXPECT_EQ(count_concurrently(counter, start), 0);
+  EXPECT_EQ(counter.snapshot(), start + kWriters * kEdgesPerWriter);
+}
+
+TEST(QuadratureEncoder, DecodersOnSeparateThreadsCountEveryEdge)
+{
+  // One decoder per wheel, each driven by its own thread like the backend
+  // callback threads, while the counters are sampled as in read().
+  constexpr size_t kWheels = 2;
+  constexpr int64_t kCycles = 250000;
+  constexpr int kA = 3;
+  constexpr int kB = 17;
+
+  EncoderCounter counters[kWheels];
+  std::vector<EncoderEdgeRing> rings(kWheels);
+  std::vector<QuadratureEncoder> decoders(kWheels);
+  for (size_t w = 0; w < kWheels; w++)
+  {
+    decoders[w].setup(kA, kB, counters[w], rings[w], 0, 0);
+  }
+
+  std::atomic<bool> done{false};
+  int64_t bad_snapshots = 0;
+  std::thread reader([&]() {bad_snapshots = watch_counters(counters, kWheels, done, 0, 4 * kCycles);});
+
+  std::vector<std::thread> callbacks;
+  for (size_t w = 0; w < kWheels; w++)
+  {
+    callbacks.emplace_back(
+      [&decoders, w]() {
+        // Counting up: B rises, A rises, B falls, A falls.
+        uint32_t tick = 0;
+        for (int64_t cycle = 0; cycle < kCycles; cycle++)
+        {
+          decoders[w].update(kB, 1, tick += 10);
+          decoders[w].update(kA, 1, tick += 10);
+          decoders[w].update(kB, 0, tick += 10);
+          decoders[w].update(kA, 0, tick += 10);
+        }
+      });
+  }
+  for (std::thread & callback : callbacks)
+  {
+    callback.join();
+  }
+  done = true;
+  reader.join();
+
+  for (size_t w = 0; w < kWheels; w++)
+  {
+    EXPECT_EQ(counters[w].snapshot(), 4 * kCycles);
+    EXPECT_EQ(decoders[w].errors.load(), 0u);
+  }
+  EXPECT_EQ(bad_snapshots, 0);
+}
+
+TEST(QuadratureEncoder, DroppedEdgeIsCountedAsAnError)
+{
+  constexpr int kA = 3;
+  constexpr int kB = 17;
+  EncoderCounter counter;
+  EncoderEdgeRing ring;
+  QuadratureEncoder decoder;
+  decoder.setup(kA, kB, counter, ring, 0, 0);
+
+  // B rises, A rises, then the B fall is lost: A falls next, followed by a
+  // B rise while B is already high.
+  decoder.update(kB, 1, 10);
+  decoder.update(kA, 1, 20);
+  decoder.update(kA, 0, 30);
+  decoder.update(kB, 1, 40);
+  EXPECT_EQ(decoder.errors.load(), 1u);
+
+  // Decoding goes on from the reported levels.
+  decoder.update(kA, 1, 50);
+  decoder.update(kB, 0, 60);
+  EXPECT_EQ(decoder.errors.load(), 1u);
+}
+
+TEST(LatestValueSlot, ConsumerNeverSeesATornValue)
+{
+  // Every published value has all fields equal, so a value mixed from two
+  // publishes shows up as unequal fields.
+  struct Command
+  {
+    int64_t duty[8];
+    int64_t stamp;
+  };
+  constexpr int64_t kPublishes = 2000000;
+
+  LatestValueSlot<Command> slot;
+  std::atomic<bool> done{false};
+  std::thread producer(
+    [&]() {
+      Command command;
+      for (int64_t i = 1; i <= kPublishes; i++)
+      {
+        std::fill(command.duty, command.duty + 8, i);
+        command.stamp = i;
+        slot.publish(command);
+      }
+      done = true;
+    });
+
+  int64_t taken = 0;
+  int64_t torn = 0;
+  int64_t out_of_order = 0;
+  int64_t last = 0;
+  Command command;
+  while (true)
+  {
+    const bool finished = done.load(std::memory_order_acquire);
+    if (!slot.take(command))
+    {
+      if (finished)
+      {
+        break;
+      }
+      continue;
+    }
+    taken++;
+    for (int64_t duty : command.duty)
+    {
+      torn += duty != command.stamp;
+    }
+    out_of_order += command.stamp <= last;
+    last = command.stamp;
+  }
+  producer.join();
+
+  EXPECT_GT(taken, 0);
+  EXPECT_EQ(torn, 0);
+  EXPECT_EQ(out_of_order, 0);
+  EXPECT_EQ(last, kPublishes);
+}